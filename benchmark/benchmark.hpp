@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "nanopb_cpp.h"
+
+/**
+ * Run `func` `iterations` times and print average time per item.
+ *
+ * @return false if `func` failed.
+ */
+template<class FUNC>
+bool measure(const char* name, size_t iterations, size_t items, FUNC func){
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        if (!func()) {
+            printf("%-40s FAILED\n", name);
+            return false;
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%-40s %8.2f ns/item\n", name, ns / double(iterations * items));
+    return true;
+}
+
+template <class TYPE>
+struct Array {
+    std::vector<TYPE> values;
+};
+
+/**
+ * Same as SCALAR_CONVERTER, but without block encoding/decoding: items are processed one by one via nanopb.
+ */
+template <class SCALAR_CONVERTER>
+class PerItemConverter : public NanoPb::Converter::CallbackConverter<PerItemConverter<SCALAR_CONVERTER>, typename SCALAR_CONVERTER::LocalType> {
+public:
+    using LocalType = typename SCALAR_CONVERTER::LocalType;
+public:
+    static constexpr pb_wire_type_t getWireType(){ return SCALAR_CONVERTER::getWireType(); }
+
+    static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local){
+        return SCALAR_CONVERTER::encodeCallback(stream, field, local);
+    }
+    static bool encodeValue(pb_ostream_t *stream, const LocalType &local){
+        return SCALAR_CONVERTER::encodeValue(stream, local);
+    }
+    static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local){
+        return SCALAR_CONVERTER::decodeCallback(stream, field, local);
+    }
+};
+
+template <class ITEM_CONVERTER, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG>
+class ArrayMessageConverter : public NanoPb::Converter::MessageConverter<
+        ArrayMessageConverter<ITEM_CONVERTER, PROTO_TYPE, PROTO_TYPE_MSG>,
+        Array<typename ITEM_CONVERTER::LocalType>,
+        PROTO_TYPE,
+        PROTO_TYPE_MSG>
+{
+    using ItemsConverter = NanoPb::Converter::PackedArrayConverter<ITEM_CONVERTER, std::vector<typename ITEM_CONVERTER::LocalType>>;
+public:
+    using ProtoType = PROTO_TYPE;
+    using LocalType = Array<typename ITEM_CONVERTER::LocalType>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .values = ItemsConverter::encoderCallbackInit(local.values)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .values = ItemsConverter::decoderCallbackInit(local.values)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
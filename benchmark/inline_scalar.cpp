@@ -0,0 +1,92 @@
+#include <vector>
+#include <random>
+
+#include "benchmark.hpp"
+#include "benchmark.pb.h"
+
+using namespace NanoPb::Converter;
+
+#if defined(__GNUC__)
+#define BENCHMARK_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BENCHMARK_NOINLINE __declspec(noinline)
+#else
+#define BENCHMARK_NOINLINE
+#endif
+
+/**
+ * Same as SCALAR, but encode()/decode() are never inlined, like when they were defined in nanopb_cpp.cpp.
+ */
+template <class SCALAR>
+class OutOfLineScalar : public SCALAR {
+public:
+    using LocalType = typename SCALAR::LocalType;
+
+    BENCHMARK_NOINLINE static bool encode(pb_ostream_t *stream, const LocalType& value){ return SCALAR::encode(stream, value); }
+    BENCHMARK_NOINLINE static bool decode(pb_istream_t *stream, LocalType& value){ return SCALAR::decode(stream, value); }
+};
+
+template <class SCALAR>
+class OutOfLineConverter : public AbstractScalarConverter<OutOfLineConverter<SCALAR>, OutOfLineScalar<SCALAR>> {};
+
+/**
+ * Repeated scalar field, encoded and decoded item by item via scalar converter callbacks.
+ */
+template <class SCALAR_CONVERTER, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG>
+bool benchmark(const char* name, const std::vector<typename SCALAR_CONVERTER::LocalType>& values){
+    using ScalarType = typename SCALAR_CONVERTER::ScalarType;
+    using InlineConverter = ArrayMessageConverter<PerItemConverter<SCALAR_CONVERTER>, PROTO_TYPE, PROTO_TYPE_MSG>;
+    using OutOfLineArrayConverter = ArrayMessageConverter<PerItemConverter<OutOfLineConverter<ScalarType>>, PROTO_TYPE, PROTO_TYPE_MSG>;
+    using LocalType = Array<typename SCALAR_CONVERTER::LocalType>;
+
+    const size_t iterations = 200;
+
+    LocalType original;
+    original.values = values;
+
+    NanoPb::StringOutputStream outputStream;
+    if (!NanoPb::encode<InlineConverter>(outputStream, original))
+        return false;
+    auto buffer = outputStream.release();
+
+    printf("%s: %zu items, %zu bytes\n", name, values.size(), buffer->size());
+
+    auto decode = [&buffer, &original](bool inlined) {
+        LocalType decoded;
+        bool result = inlined ?
+                NanoPb::decode<InlineConverter>(buffer->data(), buffer->size(), decoded) :
+                NanoPb::decode<OutOfLineArrayConverter>(buffer->data(), buffer->size(), decoded);
+        return result && decoded.values == original.values;
+    };
+
+    auto encode = [&buffer, &original](bool inlined) {
+        NanoPb::StringOutputStream stream;
+        bool result = inlined ?
+                NanoPb::encode<InlineConverter>(stream, original) :
+                NanoPb::encode<OutOfLineArrayConverter>(stream, original);
+        return result && *stream.release() == *buffer;
+    };
+
+    return measure("  decode out of line", iterations, values.size(), [&decode]{ return decode(false); }) &&
+           measure("  decode inline", iterations, values.size(), [&decode]{ return decode(true); }) &&
+           measure("  encode out of line", iterations, values.size(), [&encode]{ return encode(false); }) &&
+           measure("  encode inline", iterations, values.size(), [&encode]{ return encode(true); });
+}
+
+int main() {
+    const size_t count = 100000;
+    std::mt19937_64 random(1);
+
+    std::vector<int32_t> int32;
+    std::vector<uint64_t> uint64;
+    for (size_t i = 0; i < count; i++) {
+        int32.push_back(int32_t(random()));
+        uint64.push_back(random() >> (random() % 64));
+    }
+
+    bool result =
+            benchmark<Int32Converter, BENCHMARK_Int32Array, &BENCHMARK_Int32Array_msg>("int32", int32) &&
+            benchmark<UInt64Converter, BENCHMARK_UInt64Array, &BENCHMARK_UInt64Array_msg>("uint64", uint64);
+
+    return result ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+#include <vector>
+#include <random>
+
+#include "benchmark.hpp"
+#include "benchmark.pb.h"
+
+using namespace NanoPb::Converter;
+
+template <class SCALAR_CONVERTER, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG>
+bool benchmark(const char* name, const std::vector<typename SCALAR_CONVERTER::LocalType>& values){
+    using BlockConverter = ArrayMessageConverter<SCALAR_CONVERTER, PROTO_TYPE, PROTO_TYPE_MSG>;
+    using ItemConverter = ArrayMessageConverter<PerItemConverter<SCALAR_CONVERTER>, PROTO_TYPE, PROTO_TYPE_MSG>;
+    using LocalType = Array<typename SCALAR_CONVERTER::LocalType>;
+
+    const size_t iterations = 200;
+
+    LocalType original;
+    original.values = values;
+
+    NanoPb::StringOutputStream outputStream;
+    if (!NanoPb::encode<BlockConverter>(outputStream, original))
+        return false;
+    auto buffer = outputStream.release();
+
+    printf("%s: %zu items, %zu bytes\n", name, values.size(), buffer->size());
+
+    auto decode = [&buffer, &original](bool block) {
+        LocalType decoded;
+        bool result = block ?
+                NanoPb::decode<BlockConverter>(buffer->data(), buffer->size(), decoded) :
+                NanoPb::decode<ItemConverter>(buffer->data(), buffer->size(), decoded);
+        return result && decoded.values == original.values;
+    };
+
+    auto encode = [&buffer, &original](bool block) {
+        NanoPb::StringOutputStream stream;
+        bool result = block ?
+                NanoPb::encode<BlockConverter>(stream, original) :
+                NanoPb::encode<ItemConverter>(stream, original);
+        return result && *stream.release() == *buffer;
+    };
+
+    return measure("  decode per item", iterations, values.size(), [&decode]{ return decode(false); }) &&
+           measure("  decode block", iterations, values.size(), [&decode]{ return decode(true); }) &&
+           measure("  encode per item", iterations, values.size(), [&encode]{ return encode(false); }) &&
+           measure("  encode block", iterations, values.size(), [&encode]{ return encode(true); });
+}
+
+int main() {
+    const size_t count = 100000;
+    std::mt19937_64 random(1);
+
+    std::vector<int32_t> smallInt32;
+    std::vector<int32_t> int32;
+    std::vector<uint64_t> uint64;
+    for (size_t i = 0; i < count; i++) {
+        smallInt32.push_back(int32_t(random() % 128) - 64);
+        int32.push_back(int32_t(random()));
+        uint64.push_back(random() >> (random() % 64));
+    }
+
+    bool result =
+            benchmark<Int32Converter, BENCHMARK_Int32Array, &BENCHMARK_Int32Array_msg>("int32 [-64, 64)", smallInt32) &&
+            benchmark<Int32Converter, BENCHMARK_Int32Array, &BENCHMARK_Int32Array_msg>("int32", int32) &&
+            benchmark<UInt64Converter, BENCHMARK_UInt64Array, &BENCHMARK_UInt64Array_msg>("uint64", uint64);
+
+    return result ? 0 : 1;
+}
@@ -1,5 +1,11 @@
 #include "nanopb_cpp.h"
 
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
 #include "pb_encode.h"
 #include "pb_decode.h"
 
@@ -40,280 +46,1333 @@ bool NanoPb::StringOutputStream::_pbCallback(pb_ostream_t *stream, const pb_byte
     return true;
 }
 
+void NanoPb::StringOutputStream::reserve(size_t size) {
+    if (!_buffer)
+        return;
+    size_t available = max_size - bytes_written;
+    _buffer->reserve(_buffer->size() + (size < available ? size : available));
+}
+
+NanoPb::StringOutputStream *NanoPb::StringOutputStream::_getStringStream(pb_ostream_t &stream) {
+    if (stream.callback != &NanoPb::StringOutputStream::_pbCallback)
+        return nullptr;
+    return static_cast<NanoPb::StringOutputStream *>(stream.state);
+}
+
+size_t NanoPb::StringOutputStream::_getBufferSize() const {
+    return _buffer ? _buffer->size() : 0;
+}
+
+void NanoPb::StringOutputStream::_overwrite(size_t position, const pb_byte_t *data, size_t size) {
+    if (_buffer)
+        _buffer->replace(position, size, (const char*)data, size);
+}
+
 /****************************************************************************************************************/
 
 NanoPb::BufferPtr NanoPb::StringOutputStream::release() {
     return std::move(_buffer);
 }
 
-NanoPb::StringInputStream::StringInputStream(BufferPtr &&buffer) : _buffer(std::move(buffer)), _position(0) {
-    callback = +[](pb_istream_t *stream, pb_byte_t *buf, size_t count) -> bool {
-        auto self = static_cast<NanoPb::StringInputStream *>(stream->state);
+NanoPb::MemoryInputStream::MemoryInputStream(const void *data, size_t size) :
+    pb_istream_t(pb_istream_from_buffer(static_cast<const pb_byte_t *>(data), size))
+{
+}
+
+const pb_byte_t *NanoPb::MemoryInputStream::getCurrentPosition(const pb_istream_t *stream) {
+    // nanopb buffer reader is static, so take its address from the dummy stream.
+    static const auto bufferReadCallback = pb_istream_from_buffer(NULL, 0).callback;
+
+    if (stream->callback != bufferReadCallback)
+        return NULL;
+    return static_cast<const pb_byte_t *>(stream->state);
+}
+
+NanoPb::StringInputStream::StringInputStream(BufferPtr &&buffer) :
+    MemoryInputStream(buffer->data(), buffer->size()),
+    _buffer(std::move(buffer))
+{
+}
+
+/****************************************************************************************************************/
+
+static thread_local const NanoPb::SharedBufferPtr* activeSharedBuffer = nullptr;
+
+NanoPb::SharedInputStream::SharedInputStream(BufferPtr &&buffer) :
+    SharedInputStream(SharedBufferPtr(std::move(buffer)))
+{
+}
+
+NanoPb::SharedInputStream::SharedInputStream(const SharedBufferPtr &buffer) :
+    MemoryInputStream(buffer->data(), buffer->size()),
+    _buffer(buffer)
+{
+}
+
+NanoPb::SharedInputStream::Scope::Scope(const SharedInputStream &stream) : _previous(activeSharedBuffer) {
+    activeSharedBuffer = &stream._buffer;
+}
+
+NanoPb::SharedInputStream::Scope::~Scope() {
+    activeSharedBuffer = _previous;
+}
+
+NanoPb::SharedBufferPtr NanoPb::SharedInputStream::findBuffer(const pb_byte_t *data, size_t size) {
+    if (!activeSharedBuffer || !*activeSharedBuffer)
+        return nullptr;
+    const SharedBufferPtr& buffer = *activeSharedBuffer;
+    const pb_byte_t* begin = (const pb_byte_t*) buffer->data();
+    const pb_byte_t* end = begin + buffer->size();
+    if (data >= begin && data + size <= end)
+        return buffer;
+    return nullptr;
+}
+
+NanoPb::SharedBytes::SharedBytes(const SharedBufferPtr &buffer, const char *data, size_t size) :
+    _buffer(buffer),
+    _data(data),
+    _size(size)
+{
+}
+
+NanoPb::SharedBytes::SharedBytes(BufferType &&value) :
+    _buffer(std::make_shared<const BufferType>(std::move(value))),
+    _data(_buffer->data()),
+    _size(_buffer->size())
+{
+}
+
+NanoPb::SharedBytes::SharedBytes(const BufferType &value) :
+    SharedBytes(BufferType(value))
+{
+}
+
+/****************************************************************************************************************/
+
+static thread_local NanoPb::DecodedMessage::Scope* activeDecodedMessage = nullptr;
+
+NanoPb::DecodedMessage::Scope::Scope(const pb_istream_t &stream, const pb_msgdesc_t *fields) :
+    _data(MemoryInputStream::getCurrentPosition(&stream)),
+    _size(stream.bytes_left),
+    _fields(fields),
+    _previous(activeDecodedMessage)
+{
+    activeDecodedMessage = this;
+}
+
+NanoPb::DecodedMessage::Scope::~Scope() {
+    activeDecodedMessage = _previous;
+}
+
+bool NanoPb::DecodedMessage::countField(const pb_field_t *field, pb_wire_type_t wireType, size_t &count) {
+    const Scope* scope = activeDecodedMessage;
+    // Fields of static sub messages are decoded by nanopb inside of the parent message scope
+    if (!scope || !scope->_data || scope->_fields != field->descriptor)
+        return false;
+
+    MemoryInputStream stream(scope->_data, scope->_size);
+    pb_wire_type_t currentWireType;
+    uint32_t tag;
+    bool eof;
 
-        NANOPB_CPP_ASSERT(self->_position < self->_buffer->size());
-        if (self->_position >= self->_buffer->size())
+    count = 0;
+    while (pb_decode_tag(&stream, &currentWireType, &tag, &eof)) {
+        if (tag == field->tag && currentWireType == wireType)
+            count++;
+        if (!pb_skip_field(&stream, currentWireType))
             return false;
-        if (buf != NULL)
-        {
-            for (size_t i = 0; i < count; i++)
-                buf[i] = self->_buffer->at(self->_position + i);
+    }
+    return eof;
+}
+
+/****************************************************************************************************************/
+
+NanoPb::FieldMask::FieldMask(std::initializer_list<uint32_t> tags) {
+    for (uint32_t tag : tags) {
+        if (tag >= 1 && tag <= 64)
+            _bits |= uint64_t(1) << (tag - 1);
+        else
+            _tags.push_back(tag);
+    }
+    std::sort(_tags.begin(), _tags.end());
+}
+
+bool NanoPb::FieldMask::contains(uint32_t tag) const {
+    if (tag >= 1 && tag <= 64)
+        return (_bits >> (tag - 1)) & 1;
+    return std::binary_search(_tags.begin(), _tags.end(), tag);
+}
+
+namespace {
+    /**
+     * State of the stream of masked fields over non-memory input.
+     */
+    struct MaskedInputState {
+        pb_istream_t* input;
+        const NanoPb::FieldMask* mask;
+        pb_byte_t header[16]; // Tag and varint value or length of the current field
+        size_t headerPosition;
+        size_t headerSize;
+        size_t valueLeft; // Bytes of the current field, which are read from input as is
+    };
+}
+
+/**
+ * Read input up to the next field from the mask, skip other fields.
+ */
+static bool readMaskedField(MaskedInputState &state, bool &eof) {
+    pb_wire_type_t wireType;
+    uint32_t tag;
+    while (pb_decode_tag(state.input, &wireType, &tag, &eof)) {
+        if (!state.mask->contains(tag)) {
+            if (!pb_skip_field(state.input, wireType))
+                return false;
+            continue;
         }
 
-        self->_position += count;
+        pb_ostream_t header = pb_ostream_from_buffer(state.header, sizeof(state.header));
+        if (!pb_encode_tag(&header, wireType, tag))
+            return false;
+        state.valueLeft = 0;
+        switch (wireType) {
+            case PB_WT_VARINT: {
+                pb_uint64_t value;
+                if (!pb_decode_varint(state.input, &value) || !pb_encode_varint(&header, value))
+                    return false;
+                break;
+            }
+            case PB_WT_64BIT:
+                state.valueLeft = 8;
+                break;
+            case PB_WT_32BIT:
+                state.valueLeft = 4;
+                break;
+            case PB_WT_STRING: {
+                uint32_t length;
+                if (!pb_decode_varint32(state.input, &length) || !pb_encode_varint(&header, length))
+                    return false;
+                state.valueLeft = length;
+                break;
+            }
+            default:
+                PB_RETURN_ERROR(state.input, "invalid wire_type");
+        }
+        state.headerPosition = 0;
+        state.headerSize = header.bytes_written;
+        return true;
+    }
+    return false;
+}
+
+static bool maskedRead(pb_istream_t *stream, pb_byte_t *buf, size_t count) {
+    MaskedInputState& state = *static_cast<MaskedInputState *>(stream->state);
+    while (count > 0) {
+        if (state.headerPosition < state.headerSize) {
+            const size_t size = std::min(count, state.headerSize - state.headerPosition);
+            if (buf) {
+                memcpy(buf, state.header + state.headerPosition, size);
+                buf += size;
+            }
+            state.headerPosition += size;
+            count -= size;
+            continue;
+        }
+        if (state.valueLeft > 0) {
+            const size_t size = std::min(count, state.valueLeft);
+            if (!pb_read(state.input, buf, size))
+                return false;
+            if (buf)
+                buf += size;
+            state.valueLeft -= size;
+            count -= size;
+            continue;
+        }
+        bool eof = false;
+        if (!readMaskedField(state, eof)) {
+            // End of input is the end of the masked stream for nanopb
+            if (eof)
+                stream->bytes_left = 0;
+            return false;
+        }
+    }
+    return true;
+}
 
+static bool decodeMemoryRun(pb_istream_t &stream, const pb_byte_t *start, const pb_byte_t *end, const pb_msgdesc_t *fields, void *proto) {
+    NanoPb::MemoryInputStream run(start, end - start);
+    if (pb_decode_ex(&run, fields, proto, PB_DECODE_NOINIT))
         return true;
-    };
-    state = this;
-    bytes_left = _buffer->size();
 #ifndef PB_NO_ERRMSG
-    errmsg = NULL;
+    stream.errmsg = run.errmsg;
 #endif
+    return false;
 }
 
-/****************************************************************************************************************/
+bool NanoPb::FieldMask::_decode(pb_istream_t &stream, const pb_msgdesc_t *fields, void *proto) const {
+    // Fields are decoded without the whole message, so required fields can't be checked
+    pb_msgdesc_t withoutRequired;
+    if (fields->required_field_count > 0) {
+        withoutRequired = *fields;
+        withoutRequired.required_field_count = 0;
+        fields = &withoutRequired;
+    }
 
-const pb_msgdesc_t *NanoPb::decodeUnionMessageType(pb_istream_t &stream, const pb_msgdesc_t *unionContainer) {
-    pb_wire_type_t wire_type;
+    if (!MemoryInputStream::getCurrentPosition(&stream)) {
+        MaskedInputState state = {&stream, this, {}, 0, 0, 0};
+        pb_istream_t masked;
+        masked.callback = &maskedRead;
+        masked.state = &state;
+        masked.bytes_left = SIZE_MAX;
+#ifndef PB_NO_ERRMSG
+        masked.errmsg = NULL;
+#endif
+        if (pb_decode_ex(&masked, fields, proto, PB_DECODE_NOINIT))
+            return true;
+#ifndef PB_NO_ERRMSG
+        if (!stream.errmsg)
+            stream.errmsg = masked.errmsg;
+#endif
+        return false;
+    }
+
+    // Consecutive fields from the mask are decoded in place by one call, other fields are just skipped.
+    const pb_byte_t* runStart = NULL;
+    const pb_byte_t* runEnd = NULL;
+    pb_wire_type_t wireType;
     uint32_t tag;
     bool eof;
-
-    while (pb_decode_tag(&stream, &wire_type, &tag, &eof))
-    {
-        if (wire_type == PB_WT_STRING)
-        {
-            pb_field_iter_t iter;
-            if (pb_field_iter_begin(&iter, unionContainer, NULL) &&
-                pb_field_iter_find(&iter, tag))
-            {
-                /* Found our field. */
-                return iter.submsg_desc;
-            }
+    while (true) {
+        const pb_byte_t* fieldStart = MemoryInputStream::getCurrentPosition(&stream);
+        if (!pb_decode_tag(&stream, &wireType, &tag, &eof))
+            break;
+        if (!pb_skip_field(&stream, wireType))
+            return false;
+        if (contains(tag)) {
+            if (!runStart)
+                runStart = fieldStart;
+            runEnd = MemoryInputStream::getCurrentPosition(&stream);
+            continue;
         }
+        if (runStart && !decodeMemoryRun(stream, runStart, runEnd, fields, proto))
+            return false;
+        runStart = NULL;
+    }
+    if (!eof)
+        return false;
+    return !runStart || decodeMemoryRun(stream, runStart, runEnd, fields, proto);
+}
 
-        /* Wasn't our field.. */
-        pb_skip_field(&stream, wire_type);
+/****************************************************************************************************************/
+
+static thread_local NanoPb::DecodeReuseContext* activeDecodeReuseContext = nullptr;
+
+std::atomic<unsigned> NanoPb::DecodeReuseContext::_activeCount(0);
+
+NanoPb::DecodeReuseContext::Scope::Scope(DecodeReuseContext *context) : _context(context), _previous(activeDecodeReuseContext) {
+    activeDecodeReuseContext = context;
+    if (_context)
+        _activeCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+NanoPb::DecodeReuseContext::Scope::~Scope() {
+    activeDecodeReuseContext = _previous;
+    if (_context)
+        _activeCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+NanoPb::DecodeReuseContext::MessageScope::MessageScope(DecodeReuseContext &context) : _context(&context) {
+    _fieldsBegin = _context->_fields.size();
+    _marksBegin = _context->_marks.size();
+    _previousMarksBegin = _context->_marksBegin;
+    _context->_marksBegin = _marksBegin;
+}
+
+NanoPb::DecodeReuseContext::MessageScope::~MessageScope() {
+    if (!_context)
+        return;
+    _context->_fields.erase(_context->_fields.begin() + _fieldsBegin, _context->_fields.end());
+    _context->_marks.erase(_context->_marks.begin() + _marksBegin, _context->_marks.end());
+    _context->_marksBegin = _previousMarksBegin;
+}
+
+void NanoPb::DecodeReuseContext::MessageScope::finish() {
+    if (!_context)
+        return;
+    std::vector<Mark>& marks = _context->_marks;
+    std::sort(marks.begin() + _marksBegin, marks.end());
+    marks.erase(std::unique(marks.begin() + _marksBegin, marks.end()), marks.end());
+
+    // Finish callbacks don't decode, so no fields are added here
+    for (size_t i = _fieldsBegin; i < _context->_fields.size(); i++) {
+        const Field& field = _context->_fields[i];
+        field.finish(field.local, field.count);
     }
+}
+
+NanoPb::DecodeReuseContext *NanoPb::DecodeReuseContext::getActive() {
+    return activeDecodeReuseContext;
+}
+
+size_t NanoPb::DecodeReuseContext::addField(void *local, FinishCallback finish) {
+    _fields.push_back(Field{local, 0, finish});
+    return _fields.size() - 1;
+}
+
+void *NanoPb::DecodeReuseContext::getFieldLocal(size_t index) const {
+    return _fields[index].local;
+}
+
+size_t NanoPb::DecodeReuseContext::getFieldCount(size_t index) const {
+    return _fields[index].count;
+}
+
+void NanoPb::DecodeReuseContext::setFieldCount(size_t index, size_t count) {
+    _fields[index].count = count;
+}
+
+void NanoPb::DecodeReuseContext::mark(const void *container, const void *item) {
+    _marks.push_back(Mark(container, item));
+}
+
+bool NanoPb::DecodeReuseContext::isMarked(const void *container, const void *item) const {
+    // Marks of the current message are sorted by MessageScope::finish()
+    return std::binary_search(_marks.begin() + _marksBegin, _marks.end(), Mark(container, item));
+}
 
-    return NULL;
+size_t NanoPb::DecodeReuseContext::countMarks(const void *container) const {
+    auto it = std::lower_bound(_marks.begin() + _marksBegin, _marks.end(), Mark(container, nullptr));
+    size_t count = 0;
+    for (; it != _marks.end() && it->first == container; ++it)
+        count++;
+    return count;
 }
 
 /****************************************************************************************************************/
 
-bool NanoPb::Converter::StringConverter::encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local) {
-    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_STRING);
-    if (!pb_encode_tag_for_field(stream, field))
-        return false;
-    return pb_encode_string(stream, (const pb_byte_t *) local.c_str(), local.size());
+static thread_local NanoPb::EncodeSizeCache* activeEncodeSizeCache = nullptr;
+// Number of active caches in all threads, so encodes without cache don't look for the active one.
+static std::atomic<unsigned> activeEncodeSizeCacheCount(0);
+
+NanoPb::EncodeSizeCache::Scope::Scope(EncodeSizeCache &cache) : _previous(activeEncodeSizeCache) {
+    cache._entries.clear();
+    cache._index.clear();
+    cache._position = 0;
+    cache._writing = false;
+    activeEncodeSizeCache = &cache;
+    activeEncodeSizeCacheCount.fetch_add(1, std::memory_order_relaxed);
 }
 
-bool NanoPb::Converter::StringConverter::decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local) {
-    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_STRING);
-    size_t len = stream->bytes_left;
-    local.resize(len);
-    if (!pb_read(stream, (pb_byte_t *) local.data(), len)) {
-        return false;
+NanoPb::EncodeSizeCache::Scope::~Scope() {
+    activeEncodeSizeCache = _previous;
+    activeEncodeSizeCacheCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void NanoPb::EncodeSizeCache::startWriting() {
+    _position = 0;
+    _writing = true;
+}
+
+NanoPb::EncodeSizeCache *NanoPb::EncodeSizeCache::getActive() {
+    return activeEncodeSizeCache;
+}
+
+bool NanoPb::EncodeSizeCache::_encodeSubMessage(pb_ostream_t &stream, const pb_msgdesc_t *fields, const void *src, const void *key) {
+    if (!_writing)
+        return _encodeSized(stream, fields, src, key);
+
+    size_t size;
+    if (!_find(key, fields, size)) {
+        // Sub message wasn't met in sizing pass, calculate size as nanopb does.
+        pb_ostream_t sizingStream = PB_OSTREAM_SIZING;
+        if (!pb_encode(&sizingStream, fields, src)) {
+#ifndef PB_NO_ERRMSG
+            stream.errmsg = sizingStream.errmsg;
+#endif
+            return false;
+        }
+        size = sizingStream.bytes_written;
+    } else if (stream.callback == NULL) {
+        // nanopb sizes static sub message, which contains this one: size is known, don't encode it again.
+        if (!pb_encode_varint(&stream, size))
+            return false;
+        return pb_write(&stream, NULL, size);
     }
+    return _encodeWithSize(&stream, fields, src, size);
+}
+
+bool NanoPb::EncodeSizeCache::_find(const void *key, const pb_msgdesc_t *fields, size_t &size) {
+    // Sub messages are usually met in the same order as in sizing pass
+    if (_position < _entries.size()) {
+        const Entry& entry = _entries[_position];
+        if (entry.key == key && entry.fields == fields) {
+            size = entry.size;
+            _position++;
+            return true;
+        }
+    }
+    // Order can be different, when nanopb encodes static sub message, which contains callbacks
+    size_t index;
+    if (!_findIndexed(key, fields, index))
+        return false;
+    size = _entries[index].size;
+    _position = index + 1;
     return true;
 }
 
-bool NanoPb::Converter::BytesConverter::encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local) {
-    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_BYTES);
-    if (!pb_encode_tag_for_field(stream, field))
+bool NanoPb::EncodeSizeCache::_findIndexed(const void *key, const pb_msgdesc_t *fields, size_t &index) {
+    auto less = [this](size_t a, size_t b) {
+        const Entry& ea = _entries[a];
+        const Entry& eb = _entries[b];
+        return std::less<const void*>()(ea.key, eb.key) ||
+               (ea.key == eb.key && std::less<const void*>()(ea.fields, eb.fields));
+    };
+    if (_index.size() != _entries.size()) {
+        _index.resize(_entries.size());
+        for (size_t i = 0; i < _index.size(); i++)
+            _index[i] = i;
+        // Stable, so the first of the equal entries is found
+        std::stable_sort(_index.begin(), _index.end(), less);
+    }
+
+    auto it = std::lower_bound(_index.begin(), _index.end(), key, [this, fields](size_t i, const void* k) {
+        const Entry& entry = _entries[i];
+        return std::less<const void*>()(entry.key, k) ||
+               (entry.key == k && std::less<const void*>()(entry.fields, fields));
+    });
+    if (it == _index.end() || _entries[*it].key != key || _entries[*it].fields != fields)
         return false;
-    return pb_encode_string(stream, (const pb_byte_t *) local.c_str(), local.size());
+    index = *it;
+    return true;
 }
 
-bool NanoPb::Converter::BytesConverter::decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local) {
-    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_BYTES);
-    size_t len = stream->bytes_left;
-    local.resize(len);
-    if (!pb_read(stream, (pb_byte_t *) local.data(), len)) {
+bool NanoPb::EncodeSizeCache::_encodeSized(pb_ostream_t &stream, const pb_msgdesc_t *fields, const void *src, const void *key) {
+    NANOPB_CPP_ASSERT(stream.callback == NULL);
+
+    // Reserve entry before encoding, so entries will be in the same order as sub messages in writing pass.
+    size_t index = _entries.size();
+    _entries.push_back(Entry{key, fields, 0});
+
+    pb_ostream_t sizingStream = PB_OSTREAM_SIZING;
+    if (!pb_encode(&sizingStream, fields, src)) {
+#ifndef PB_NO_ERRMSG
+        stream.errmsg = sizingStream.errmsg;
+#endif
         return false;
     }
-    return true;
+    size_t size = sizingStream.bytes_written;
+    _entries[index].size = size;
+
+    if (!pb_encode_varint(&stream, size))
+        return false;
+    return pb_write(&stream, NULL, size);
+}
+
+bool NanoPb::EncodeSizeCache::_encodeWithSize(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src, size_t size) {
+    if (!pb_encode_varint(stream, size))
+        return false;
+
+    if (stream->callback != NULL && stream->bytes_written + size > stream->max_size)
+        PB_RETURN_ERROR(stream, "stream full");
+
+    // Use a substream to verify that size is the same as in sizing pass
+    pb_ostream_t substream = PB_OSTREAM_SIZING;
+    substream.callback = stream->callback;
+    substream.state = stream->state;
+    substream.max_size = size;
+
+    bool status = pb_encode(&substream, fields, src);
+
+    stream->bytes_written += substream.bytes_written;
+    stream->state = substream.state;
+#ifndef PB_NO_ERRMSG
+    stream->errmsg = substream.errmsg;
+#endif
+
+    if (status && substream.bytes_written != size)
+        PB_RETURN_ERROR(stream, "submsg size changed");
+
+    return status;
 }
 
 /****************************************************************************************************************/
 
-bool NanoPb::Type::Int32::encode(pb_ostream_t *stream, const int32_t &value) {
-    pb_int64_t v = value;
-    return pb_encode_svarint(stream, v);
+static thread_local pb_ostream_t* activeSinglePassStream = nullptr;
+
+// Length of the sub message in single pass encoding: varint padded to 5 bytes, enough for any 32 bit length.
+static const size_t singlePassLengthSize = 5;
+
+NanoPb::_SinglePassScope::_SinglePassScope(pb_ostream_t &stream) : _previous(activeSinglePassStream) {
+    activeSinglePassStream = &stream;
 }
 
-bool NanoPb::Type::Int32::decode(pb_istream_t *stream, int32_t &value) {
-    pb_int64_t v;
-    if (!pb_decode_svarint(stream, &v))
-        return false;
-    value = v;
-    return true;
+NanoPb::_SinglePassScope::~_SinglePassScope() {
+    activeSinglePassStream = _previous;
 }
 
-/******************************************/
+static bool isBufferStream(const pb_ostream_t &stream) {
+    // nanopb buffer writer is static, so take its address from the dummy stream.
+    static const auto bufferWriteCallback = pb_ostream_from_buffer(NULL, 0).callback;
+    return stream.callback == bufferWriteCallback;
+}
+
+bool NanoPb::_SinglePassScope::isSupported(pb_ostream_t &stream) {
+    return stream.callback == NULL
+        || isBufferStream(stream)
+        || StringOutputStream::_getStringStream(stream);
+}
 
-bool NanoPb::Type::SInt32::encode(pb_ostream_t *stream, const int32_t &value) {
-    pb_int64_t v = value;
-    return pb_encode_svarint(stream, v);
+bool NanoPb::_SinglePassScope::isActive(const pb_ostream_t &stream) {
+    const pb_ostream_t* root = activeSinglePassStream;
+    if (!root)
+        return false;
+    // Substreams, created by nanopb for static sub messages, are the sizing stream
+    // and the copy of the root stream, they are written in single pass too, so sizes of both passes match.
+    return &stream == root
+        || stream.callback == NULL
+        || (stream.callback == root->callback && (isBufferStream(stream) || stream.state == root->state));
 }
 
-bool NanoPb::Type::SInt32::decode(pb_istream_t *stream, int32_t &value) {
-    pb_int64_t v;
-    if (!pb_decode_svarint(stream, &v))
+bool NanoPb::_SinglePassScope::encodeSubMessage(pb_ostream_t &stream, const pb_msgdesc_t *fields, const void *src) {
+    // Position of the length is taken before it's written
+    StringOutputStream* stringStream = StringOutputStream::_getStringStream(stream);
+    const size_t lengthPosition = stringStream ? stringStream->_getBufferSize() : 0;
+    pb_byte_t* lengthData = isBufferStream(stream) ? static_cast<pb_byte_t*>(stream.state) : NULL;
+    const size_t start = stream.bytes_written;
+
+    pb_byte_t length[singlePassLengthSize] = {};
+    if (!pb_write(&stream, length, sizeof(length)))
         return false;
-    value = v;
+
+    if (!pb_encode(&stream, fields, src))
+        return false;
+
+    size_t size = stream.bytes_written - start - sizeof(length);
+    if (size > UINT32_MAX) {
+        pb_ostream_t* pStream = &stream;
+        PB_RETURN_ERROR(pStream, "submsg too large");
+    }
+
+    for (size_t i = 0; i < sizeof(length) - 1; i++) {
+        length[i] = (pb_byte_t) ((size & 0x7F) | 0x80);
+        size >>= 7;
+    }
+    length[sizeof(length) - 1] = (pb_byte_t) size;
+
+    if (stringStream)
+        stringStream->_overwrite(lengthPosition, length, sizeof(length));
+    else if (lengthData)
+        memcpy(lengthData, length, sizeof(length));
+    // Sizing stream has nothing to overwrite
     return true;
 }
 
-/******************************************/
+bool NanoPb::encodeSubMessage(pb_ostream_t &stream, const pb_msgdesc_t *fields, const void *src, const void *key) {
+    if (_SinglePassScope::isActive(stream))
+        return _SinglePassScope::encodeSubMessage(stream, fields, src);
 
-bool NanoPb::Type::UInt32::encode(pb_ostream_t *stream, const uint32_t &value) {
-    return pb_encode_varint(stream, value);
+    if (activeEncodeSizeCacheCount.load(std::memory_order_relaxed) != 0) {
+        EncodeSizeCache* cache = EncodeSizeCache::getActive();
+        if (cache)
+            return cache->_encodeSubMessage(stream, fields, src, key);
+    }
+
+    return pb_encode_submessage(&stream, fields, src);
 }
 
-bool NanoPb::Type::UInt32::decode(pb_istream_t *stream, uint32_t &value) {
-    return pb_decode_varint32(stream, &value);
+/****************************************************************************************************************/
+
+#if defined(__GNUC__)
+#define NANOPB_CPP_LOWEST_BIT(v) ((unsigned)__builtin_ctzll(v))
+#else
+static unsigned lowestBit(uint64_t v) {
+    unsigned bit = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        bit++;
+    }
+    return bit;
 }
+#define NANOPB_CPP_LOWEST_BIT(v) lowestBit(v)
+#endif
 
-/******************************************/
+/**
+ * Read single varint from memory.
+ *
+ * @return varint length, or 0 if it is truncated or should be decoded by nanopb.
+ */
+static size_t readVarint(const pb_byte_t *data, size_t size, uint64_t &value) {
+    if (data[0] < 0x80) {
+        value = data[0];
+        return 1;
+    }
+
+#if defined(PB_LITTLE_ENDIAN_8BIT) && PB_LITTLE_ENDIAN_8BIT
+    if (size >= 8) {
+        // Up to 8 bytes varint: find terminating byte by cleared high bit and join 7-bit groups in register.
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        const uint64_t stops = ~word & 0x8080808080808080ULL;
+        if (stops) {
+            const unsigned bits = NANOPB_CPP_LOWEST_BIT(stops) + 1;
+            uint64_t v = (bits == 64 ? word : word & ((uint64_t(1) << bits) - 1)) & 0x7F7F7F7F7F7F7F7FULL;
+            v = ((v & 0x7F007F007F007F00ULL) >> 1) | (v & 0x007F007F007F007FULL);
+            v = ((v & 0x3FFF00003FFF0000ULL) >> 2) | (v & 0x00003FFF00003FFFULL);
+            v = ((v & 0x0FFFFFFF00000000ULL) >> 4) | (v & 0x000000000FFFFFFFULL);
+            value = v;
+            return bits / 8;
+        }
+    }
+#endif
 
-bool NanoPb::Type::Fixed32::encode(pb_ostream_t *stream, const uint32_t &value) {
-    return pb_encode_fixed32(stream, &value);
+    uint64_t result = 0;
+    for (size_t i = 0; i < size && i < 10; i++) {
+        // Leave overflowing 10th byte to nanopb
+        if (i == 9 && data[i] > 1)
+            return 0;
+        result |= uint64_t(data[i] & 0x7F) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            value = result;
+            return i + 1;
+        }
+    }
+    return 0;
 }
 
-bool NanoPb::Type::Fixed32::decode(pb_istream_t *stream, uint32_t &value) {
-    return pb_decode_fixed32(stream, &value);
+size_t NanoPb::decodeVarints(const pb_byte_t *data, size_t size, pb_uint64_t maxValue, pb_uint64_t *values, size_t &count) {
+    const size_t capacity = count;
+    size_t position = 0;
+
+    count = 0;
+    while (count < capacity && position < size) {
+        uint64_t value;
+        const size_t length = readVarint(data + position, size - position, value);
+        if (length == 0 || value > maxValue)
+            break;
+        values[count++] = (pb_uint64_t) value;
+        position += length;
+    }
+    return position;
 }
 
-/******************************************/
+size_t NanoPb::encodedVarintsSize(const pb_uint64_t *values, size_t count) {
+    size_t size = count;
+    for (size_t i = 0; i < count; i++) {
+        // Each 7 bits after first 7 bits add one byte
+        pb_uint64_t value = values[i] >> 7;
+        while (value) {
+            size++;
+            value >>= 7;
+        }
+    }
+    return size;
+}
 
-bool NanoPb::Type::SFixed32::encode(pb_ostream_t *stream, const int32_t &value) {
-    return pb_encode_fixed32(stream, &value);
+bool NanoPb::encodeVarints(pb_ostream_t *stream, const pb_uint64_t *values, size_t count) {
+    pb_byte_t buffer[256];
+    size_t size = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        // Flush if next varint may not fit
+        if (size > sizeof(buffer) - 10) {
+            if (!pb_write(stream, buffer, size))
+                return false;
+            size = 0;
+        }
+        pb_uint64_t value = values[i];
+        while (value >= 0x80) {
+            buffer[size++] = (pb_byte_t) (value | 0x80);
+            value >>= 7;
+        }
+        buffer[size++] = (pb_byte_t) value;
+    }
+    return pb_write(stream, buffer, size);
 }
 
-bool NanoPb::Type::SFixed32::decode(pb_istream_t *stream, int32_t &value) {
-    return pb_decode_fixed32(stream, &value);
+/****************************************************************************************************************/
+
+/**
+ * Walk top level fields of the message. Visitor should read or skip field value and return false to stop.
+ *
+ * @return true if whole message was walked.
+ */
+template<class VISITOR>
+static bool walkFields(pb_istream_t &stream, VISITOR visitor) {
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof;
+
+    while (pb_decode_tag(&stream, &wire_type, &tag, &eof))
+    {
+        if (!visitor(tag, wire_type))
+            return false;
+    }
+    return eof;
 }
 
-/******************************************/
+NanoPb::UnionTable::UnionTable(const pb_msgdesc_t *unionContainer) : _unionContainer(unionContainer) {
+    pb_field_iter_t iter;
+    if (pb_field_iter_begin(&iter, unionContainer, NULL)) {
+        do {
+            if (PB_LTYPE_IS_SUBMSG(iter.type) && iter.submsg_desc) {
+                _tags.push_back(TagEntry(iter.tag, iter.submsg_desc));
+                _types.push_back(TypeEntry(iter.submsg_desc, iter.tag));
+            }
+        } while (pb_field_iter_next(&iter));
+    }
+    std::sort(_tags.begin(), _tags.end());
+    std::sort(_types.begin(), _types.end());
+
+    if (_tags.empty())
+        return;
+
+    // Direct indexing if there are no big gaps between tags
+    _minTag = _tags.front().first;
+    const size_t range = _tags.back().first - _minTag + 1;
+    if (range <= _tags.size() * 2 + 16) {
+        _dense.resize(range, NULL);
+        for (const auto& entry : _tags)
+            _dense[entry.first - _minTag] = entry.second;
+    }
+}
+
+const NanoPb::UnionTable &NanoPb::UnionTable::get(const pb_msgdesc_t *unionContainer) {
+    // Tables are built once and never removed, so each thread caches pointers to them without locking.
+    static std::mutex mutex;
+    static std::unordered_map<const pb_msgdesc_t*, std::unique_ptr<UnionTable>> tables;
+    static thread_local std::unordered_map<const pb_msgdesc_t*, const UnionTable*> cache;
+
+    auto cached = cache.find(unionContainer);
+    if (cached != cache.end())
+        return *cached->second;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<UnionTable>& table = tables[unionContainer];
+    if (!table)
+        table.reset(new UnionTable(unionContainer));
+    cache.emplace(unionContainer, table.get());
+    return *table;
+}
+
+const pb_msgdesc_t *NanoPb::UnionTable::findMessageType(uint32_t tag) const {
+    if (!_dense.empty())
+        return (tag >= _minTag && tag - _minTag < _dense.size()) ? _dense[tag - _minTag] : NULL;
 
-bool NanoPb::Type::Float::encode(pb_ostream_t *stream, const float &value) {
-    return pb_encode_fixed32(stream, &value);
+    auto it = std::lower_bound(_tags.begin(), _tags.end(), TagEntry(tag, NULL));
+    return (it != _tags.end() && it->first == tag) ? it->second : NULL;
 }
 
-bool NanoPb::Type::Float::decode(pb_istream_t *stream, float &value) {
-    return pb_decode_fixed32(stream, &value);
+uint32_t NanoPb::UnionTable::findTag(const pb_msgdesc_t *messageType) const {
+    auto it = std::lower_bound(_types.begin(), _types.end(), TypeEntry(messageType, 0));
+    return (it != _types.end() && it->first == messageType) ? it->second : 0;
 }
 
-/******************************************/
+const pb_msgdesc_t *NanoPb::decodeUnionMessageType(pb_istream_t &stream, const pb_msgdesc_t *unionContainer) {
+    return decodeUnionMessageType(stream, UnionTable::get(unionContainer));
+}
+
+const pb_msgdesc_t *NanoPb::decodeUnionMessageType(pb_istream_t &stream, const UnionTable &table) {
+    const pb_msgdesc_t* result = NULL;
+
+    walkFields(stream, [&stream, &result, &table](uint32_t tag, pb_wire_type_t wire_type) -> bool {
+        if (wire_type == PB_WT_STRING)
+        {
+            result = table.findMessageType(tag);
+            /* Found our field. */
+            if (result)
+                return false;
+        }
 
-bool NanoPb::Type::Bool::encode(pb_ostream_t *stream, const bool &value) {
-    uint32_t v = value;
-    return pb_encode_varint(stream, v);
+        /* Wasn't our field.. */
+        return pb_skip_field(&stream, wire_type);
+    });
+
+    return result;
 }
 
-bool NanoPb::Type::Bool::decode(pb_istream_t *stream, bool &value) {
-    uint32_t v;
-    if (!pb_decode_varint32(stream, &v))
+/****************************************************************************************************************/
+
+/**
+ * Find value of the last occurrence of the field by path in the encoded message.
+ * Protobuf merges occurrences of non-repeated sub message, so each of them is searched and later occurrences win.
+ * Only the last occurrence is used for repeated sub messages and for the last field of the path.
+ *
+ * @param found - set to true, when field is found
+ * @return false if path doesn't match descriptors or message is malformed.
+ */
+static bool findPathField(const pb_byte_t *data, size_t size, const pb_msgdesc_t *fields, const uint32_t *tag, const uint32_t *pathEnd,
+                          pb_field_iter_t &field, const pb_byte_t *&value, size_t &valueSize, bool &found) {
+    pb_field_iter_t iter;
+    if (!fields || !pb_field_iter_begin(&iter, fields, NULL) || !pb_field_iter_find(&iter, *tag))
+        return false;
+    const bool isLast = tag + 1 == pathEnd;
+    if (!isLast && !PB_LTYPE_IS_SUBMSG(iter.type))
+        return false;
+    const bool merge = !isLast && PB_HTYPE(iter.type) != PB_HTYPE_REPEATED;
+
+    NanoPb::MemoryInputStream stream(data, size);
+    bool hasOccurrence = false;
+    pb_wire_type_t wireType = PB_WT_VARINT;
+    const pb_byte_t* occurrence = NULL;
+    size_t occurrenceSize = 0;
+    const bool result = walkFields(stream, [&](uint32_t currentTag, pb_wire_type_t currentWireType) -> bool {
+        if (currentTag != *tag)
+            return pb_skip_field(&stream, currentWireType);
+
+        hasOccurrence = true;
+        wireType = currentWireType;
+        if (currentWireType == PB_WT_STRING) {
+            uint32_t length;
+            if (!pb_decode_varint32(&stream, &length))
+                return false;
+            occurrence = NanoPb::MemoryInputStream::getCurrentPosition(&stream);
+            occurrenceSize = length;
+            if (!pb_read(&stream, NULL, length))
+                return false;
+        } else {
+            occurrence = NanoPb::MemoryInputStream::getCurrentPosition(&stream);
+            if (!pb_skip_field(&stream, currentWireType))
+                return false;
+            occurrenceSize = NanoPb::MemoryInputStream::getCurrentPosition(&stream) - occurrence;
+        }
+        if (!merge)
+            return true;
+        if (currentWireType != PB_WT_STRING)
+            return false;
+        return findPathField(occurrence, occurrenceSize, iter.submsg_desc, tag + 1, pathEnd, field, value, valueSize, found);
+    });
+    if (!result)
+        return false;
+    if (merge || !hasOccurrence)
+        return true;
+
+    if (isLast) {
+        field = iter;
+        value = occurrence;
+        valueSize = occurrenceSize;
+        found = true;
+        return true;
+    }
+    // Descend into the last item of repeated sub message
+    if (wireType != PB_WT_STRING)
+        return false;
+    return findPathField(occurrence, occurrenceSize, iter.submsg_desc, tag + 1, pathEnd, field, value, valueSize, found);
+}
+
+bool NanoPb::findField(const void *data, size_t size, const pb_msgdesc_t *fields, std::initializer_list<uint32_t> path,
+                       pb_field_iter_t &field, pb_istream_t &value) {
+    if (path.size() == 0)
+        return false;
+
+    const pb_byte_t* fieldValue = NULL;
+    size_t fieldValueSize = 0;
+    bool found = false;
+    if (!findPathField(static_cast<const pb_byte_t *>(data), size, fields, path.begin(), path.end(), field, fieldValue, fieldValueSize, found) || !found)
         return false;
-    value = v;
+    value = pb_istream_from_buffer(fieldValue, fieldValueSize);
     return true;
 }
 
-/******************************************/
+/****************************************************************************************************************/
 
-bool NanoPb::Type::String::encode(pb_ostream_t *stream, const std::string &value) {
-    return pb_write(stream, (const pb_byte_t *) value.data(), value.size());
+NanoPb::FieldFilter::FieldFilter(std::initializer_list<Field> fields) : _fields(fields) {
+    std::sort(_fields.begin(), _fields.end());
 }
 
-bool NanoPb::Type::String::decode(pb_istream_t *stream, std::string &value) {
-    size_t len = stream->bytes_left;
-    value.resize(len);
-    return pb_read(stream, (pb_byte_t *) value.data(), len);
+bool NanoPb::FieldFilter::contains(const pb_msgdesc_t *message, uint32_t tag) const {
+    return std::binary_search(_fields.begin(), _fields.end(), Field(message, tag));
 }
 
-/******************************************/
+/**
+ * Copy bytes from input to output, directly from memory if possible.
+ */
+static bool copyBytes(pb_istream_t &input, pb_ostream_t &output, size_t size) {
+    const pb_byte_t* data = NanoPb::MemoryInputStream::getCurrentPosition(&input);
+    if (data)
+        return pb_read(&input, NULL, size) && pb_write(&output, data, size);
+
+    pb_byte_t buffer[256];
+    while (size > 0) {
+        const size_t chunk = std::min(size, sizeof(buffer));
+        if (!pb_read(&input, buffer, chunk) || !pb_write(&output, buffer, chunk))
+            return false;
+        size -= chunk;
+    }
+    return true;
+}
 
-bool NanoPb::Type::Bytes::encode(pb_ostream_t *stream, const std::string &value) {
-    return String::encode(stream, value);
+namespace {
+    /**
+     * Size of the stripped sub message, recorded in order of appearance by the sizing pass.
+     */
+    struct StrippedSize {
+        size_t size;
+        size_t descendants; // Number of sub messages inside, their sizes are skipped when sub message is copied as is
+    };
+    using StrippedSizes = std::vector<StrippedSize>;
 }
 
-bool NanoPb::Type::Bytes::decode(pb_istream_t *stream, std::string &value) {
-    return String::decode(stream, value);
+static size_t varintSize(pb_uint64_t value) {
+    size_t size = 1;
+    while (value >>= 7)
+        size++;
+    return size;
 }
 
-/******************************************/
+/**
+ * Find sub message field with iterator created once per message: fields are usually encoded in order.
+ */
+static bool findSubMessage(pb_field_iter_t &iter, bool hasFields, uint32_t tag) {
+    return hasFields && pb_field_iter_find(&iter, tag) && PB_LTYPE_IS_SUBMSG(iter.type) && iter.submsg_desc;
+}
+
+static bool sizeStrippedSubMessage(const pb_byte_t *data, size_t size, const pb_msgdesc_t *fields,
+                                   const NanoPb::FieldFilter &filter, StrippedSizes &sizes);
+
+/**
+ * Sizing pass: calculate size of the message without filtered fields, record sizes of its sub messages.
+ */
+static bool sizeStrippedMessage(const pb_byte_t *data, size_t size, const pb_msgdesc_t *fields,
+                                const NanoPb::FieldFilter &filter, StrippedSizes &sizes, size_t &strippedSize) {
+    NanoPb::MemoryInputStream input(data, size);
+    pb_field_iter_t iter;
+    const bool hasFields = pb_field_iter_begin(&iter, fields, NULL);
+    strippedSize = 0;
+    return walkFields(input, [&](uint32_t tag, pb_wire_type_t wire_type) -> bool {
+        if (filter.contains(fields, tag))
+            return pb_skip_field(&input, wire_type);
+
+        strippedSize += varintSize(((pb_uint64_t) tag << 3) | wire_type);
+        switch (wire_type) {
+            case PB_WT_VARINT: {
+                pb_uint64_t value;
+                if (!pb_decode_varint(&input, &value))
+                    return false;
+                strippedSize += varintSize(value);
+                return true;
+            }
+            case PB_WT_64BIT:
+                strippedSize += 8;
+                return pb_read(&input, NULL, 8);
+            case PB_WT_32BIT:
+                strippedSize += 4;
+                return pb_read(&input, NULL, 4);
+            case PB_WT_STRING:
+                break;
+            default: {
+                pb_istream_t* stream = &input;
+                PB_RETURN_ERROR(stream, "unsupported wire type");
+            }
+        }
 
-#ifndef PB_WITHOUT_64BIT
+        uint32_t length;
+        if (!pb_decode_varint32(&input, &length))
+            return false;
+        const pb_byte_t* value = NanoPb::MemoryInputStream::getCurrentPosition(&input);
+        if (!pb_read(&input, NULL, length))
+            return false;
+        if (!findSubMessage(iter, hasFields, tag)) {
+            strippedSize += varintSize(length) + length;
+            return true;
+        }
 
-bool NanoPb::Type::Int64::encode(pb_ostream_t *stream, const int64_t &value) {
-    return pb_encode_svarint(stream, value);
+        const size_t index = sizes.size();
+        if (!sizeStrippedSubMessage(value, length, iter.submsg_desc, filter, sizes))
+            return false;
+        strippedSize += varintSize(sizes[index].size) + sizes[index].size;
+        return true;
+    });
 }
 
-bool NanoPb::Type::Int64::decode(pb_istream_t *stream, int64_t &value) {
-    pb_int64_t v;
-    if (!pb_decode_svarint(stream, &v))
+static bool sizeStrippedSubMessage(const pb_byte_t *data, size_t size, const pb_msgdesc_t *fields,
+                                   const NanoPb::FieldFilter &filter, StrippedSizes &sizes) {
+    const size_t index = sizes.size();
+    sizes.push_back(StrippedSize{0, 0});
+    size_t strippedSize;
+    if (!sizeStrippedMessage(data, size, fields, filter, sizes, strippedSize))
         return false;
-    value = v;
+    sizes[index] = StrippedSize{strippedSize, sizes.size() - index - 1};
     return true;
 }
 
-/******************************************/
+/**
+ * Writing pass: copy message without filtered fields.
+ *
+ * Sizes of sub messages are taken from `sizes` starting at `position`.
+ * Root message may be read from non-memory stream, so its sub messages are buffered and sized one by one.
+ */
+static bool writeStrippedMessage(pb_istream_t &input, pb_ostream_t &output, const pb_msgdesc_t *fields,
+                                 const NanoPb::FieldFilter &filter, StrippedSizes &sizes, size_t &position, bool isRoot) {
+    pb_field_iter_t iter;
+    const bool hasFields = pb_field_iter_begin(&iter, fields, NULL);
+    return walkFields(input, [&](uint32_t tag, pb_wire_type_t wire_type) -> bool {
+        if (filter.contains(fields, tag))
+            return pb_skip_field(&input, wire_type);
+
+        if (!pb_encode_tag(&output, wire_type, tag))
+            return false;
+
+        switch (wire_type) {
+            case PB_WT_VARINT: {
+                pb_uint64_t value;
+                return pb_decode_varint(&input, &value) && pb_encode_varint(&output, value);
+            }
+            case PB_WT_64BIT:
+                return copyBytes(input, output, 8);
+            case PB_WT_32BIT:
+                return copyBytes(input, output, 4);
+            case PB_WT_STRING:
+                break;
+            default: {
+                pb_istream_t* stream = &input;
+                PB_RETURN_ERROR(stream, "unsupported wire type");
+            }
+        }
+
+        uint32_t length;
+        if (!pb_decode_varint32(&input, &length))
+            return false;
+
+        if (!findSubMessage(iter, hasFields, tag))
+            return pb_encode_varint(&output, length) && copyBytes(input, output, length);
+
+        // Sub message should be in memory to get its size before writing
+        const pb_byte_t* data = NanoPb::MemoryInputStream::getCurrentPosition(&input);
+        NanoPb::BufferType buffer;
+        if (data) {
+            if (!pb_read(&input, NULL, length))
+                return false;
+        } else {
+            buffer.resize(length);
+            if (!pb_read(&input, (pb_byte_t *) &buffer[0], length))
+                return false;
+            data = (const pb_byte_t *) buffer.data();
+        }
+
+        if (isRoot) {
+            sizes.clear();
+            position = 0;
+            if (!sizeStrippedSubMessage(data, length, iter.submsg_desc, filter, sizes))
+                return false;
+        }
+        const StrippedSize& stripped = sizes[position++];
+        if (!pb_encode_varint(&output, stripped.size))
+            return false;
+        // Nothing was stripped
+        if (stripped.size == length) {
+            position += stripped.descendants;
+            return pb_write(&output, data, length);
+        }
+        NanoPb::MemoryInputStream subInput(data, length);
+        return writeStrippedMessage(subInput, output, iter.submsg_desc, filter, sizes, position, false);
+    });
+}
+
+bool NanoPb::stripFields(pb_istream_t &input, pb_ostream_t &output, const pb_msgdesc_t *fields, const FieldFilter &filter) {
+    StrippedSizes sizes;
+    size_t position = 0;
+    return writeStrippedMessage(input, output, fields, filter, sizes, position, true);
+}
+
+/****************************************************************************************************************/
+
+static bool isTagLess(const NanoPb::FieldIndex::Entry &a, const NanoPb::FieldIndex::Entry &b) {
+    return a.tag < b.tag;
+}
+
+bool NanoPb::FieldIndex::build(const void *data, size_t size, const pb_msgdesc_t *fields) {
+    _data = static_cast<const pb_byte_t *>(data);
+    _fields = fields;
+    _entries.clear();
+
+    MemoryInputStream stream(data, size);
+    const bool result = walkFields(stream, [this, &stream](uint32_t tag, pb_wire_type_t wire_type) -> bool {
+        Entry entry = {tag, wire_type, 0, 0};
+        if (wire_type == PB_WT_STRING) {
+            uint32_t length;
+            if (!pb_decode_varint32(&stream, &length))
+                return false;
+            entry.offset = MemoryInputStream::getCurrentPosition(&stream) - _data;
+            entry.size = length;
+            if (!pb_read(&stream, NULL, length))
+                return false;
+        } else {
+            entry.offset = MemoryInputStream::getCurrentPosition(&stream) - _data;
+            if (!pb_skip_field(&stream, wire_type))
+                return false;
+            entry.size = MemoryInputStream::getCurrentPosition(&stream) - _data - entry.offset;
+        }
+        _entries.push_back(entry);
+        return true;
+    });
 
-bool NanoPb::Type::SInt64::encode(pb_ostream_t *stream, const int64_t &value) {
-    pb_int64_t v = value;
-    return pb_encode_svarint(stream, v);
+    std::stable_sort(_entries.begin(), _entries.end(), isTagLess);
+    return result;
 }
 
-bool NanoPb::Type::SInt64::decode(pb_istream_t *stream, int64_t &value) {
-    pb_int64_t v;
-    if (!pb_decode_svarint(stream, &v))
+size_t NanoPb::FieldIndex::count(uint32_t tag) const {
+    auto range = std::equal_range(_entries.begin(), _entries.end(), Entry{tag, PB_WT_VARINT, 0, 0}, isTagLess);
+    return range.second - range.first;
+}
+
+const NanoPb::FieldIndex::Entry *NanoPb::FieldIndex::find(uint32_t tag, size_t index) const {
+    auto range = std::equal_range(_entries.begin(), _entries.end(), Entry{tag, PB_WT_VARINT, 0, 0}, isTagLess);
+    if (index >= size_t(range.second - range.first))
+        return NULL;
+    return &*(range.first + index);
+}
+
+bool NanoPb::FieldIndex::_getField(uint32_t tag, size_t index, pb_field_iter_t &field, pb_istream_t &stream) const {
+    const Entry* entry = find(tag, index);
+    if (!entry)
         return false;
-    value = v;
+    if (!pb_field_iter_begin(&field, _fields, NULL) || !pb_field_iter_find(&field, tag))
+        return false;
+    stream = pb_istream_from_buffer(_data + entry->offset, entry->size);
     return true;
 }
-/******************************************/
 
+/****************************************************************************************************************/
 
-bool NanoPb::Type::UInt64::encode(pb_ostream_t *stream, const uint64_t &value) {
-    return pb_encode_varint(stream, value);
+bool NanoPb::Converter::StringConverter::encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_STRING);
+    if (!FieldTag(field->tag, PB_WT_STRING).write(stream))
+        return false;
+    return encodeValue(stream, local);
+}
+
+bool NanoPb::Converter::StringConverter::encodeValue(pb_ostream_t *stream, const LocalType &local) {
+    return pb_encode_string(stream, (const pb_byte_t *) local.c_str(), local.size());
 }
 
-bool NanoPb::Type::UInt64::decode(pb_istream_t *stream, uint64_t &value) {
-    pb_uint64_t v;
-    if (!pb_decode_varint(stream, &v))
+bool NanoPb::Converter::StringConverter::decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_STRING);
+    return Type::String::decode(stream, local);
+}
+
+bool NanoPb::Converter::BytesConverter::encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_BYTES);
+    if (!FieldTag(field->tag, PB_WT_STRING).write(stream))
         return false;
-    value = v;
-    return true;
+    return encodeValue(stream, local);
 }
 
-/******************************************/
+bool NanoPb::Converter::BytesConverter::encodeValue(pb_ostream_t *stream, const LocalType &local) {
+    return pb_encode_string(stream, (const pb_byte_t *) local.c_str(), local.size());
+}
 
-bool NanoPb::Type::Fixed64::encode(pb_ostream_t *stream, const uint64_t &value) {
-    return pb_encode_fixed64(stream, &value);
+bool NanoPb::Converter::BytesConverter::decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_BYTES);
+    return Type::Bytes::decode(stream, local);
 }
 
-bool NanoPb::Type::Fixed64::decode(pb_istream_t *stream, uint64_t &value) {
-    return pb_decode_fixed64(stream, &value);
+/****************************************************************************************************************/
+
+static bool decodeStringView(pb_istream_t *stream, NanoPb::StringView &local) {
+    const pb_byte_t* data = NanoPb::MemoryInputStream::getCurrentPosition(stream);
+    if (!data)
+        PB_RETURN_ERROR(stream, "string view requires memory stream");
+    const size_t len = stream->bytes_left;
+    local = NanoPb::StringView((const char *) data, len);
+    return pb_read(stream, NULL, len);
 }
 
-/******************************************/
+bool NanoPb::Converter::StringViewConverter::encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_STRING);
+    if (!FieldTag(field->tag, PB_WT_STRING).write(stream))
+        return false;
+    return encodeValue(stream, local);
+}
 
-bool NanoPb::Type::SFixed64::encode(pb_ostream_t *stream, const int64_t &value) {
-    return pb_encode_fixed64(stream, &value);
+bool NanoPb::Converter::StringViewConverter::encodeValue(pb_ostream_t *stream, const LocalType &local) {
+    return pb_encode_string(stream, (const pb_byte_t *) local.data(), local.size());
+}
+
+bool NanoPb::Converter::StringViewConverter::decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_STRING);
+    return decodeStringView(stream, local);
+}
+
+bool NanoPb::Converter::BytesViewConverter::encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_BYTES);
+    if (!FieldTag(field->tag, PB_WT_STRING).write(stream))
+        return false;
+    return encodeValue(stream, local);
 }
 
-bool NanoPb::Type::SFixed64::decode(pb_istream_t *stream, int64_t &value) {
-    return pb_decode_fixed64(stream, &value);
+bool NanoPb::Converter::BytesViewConverter::encodeValue(pb_ostream_t *stream, const LocalType &local) {
+    return pb_encode_string(stream, (const pb_byte_t *) local.data(), local.size());
+}
+
+bool NanoPb::Converter::BytesViewConverter::decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_BYTES);
+    return decodeStringView(stream, local);
+}
+
+bool NanoPb::Converter::SharedBytesConverter::encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_BYTES);
+    if (!FieldTag(field->tag, PB_WT_STRING).write(stream))
+        return false;
+    return encodeValue(stream, local);
+}
+
+bool NanoPb::Converter::SharedBytesConverter::encodeValue(pb_ostream_t *stream, const LocalType &local) {
+    return pb_encode_string(stream, (const pb_byte_t *) local.data(), local.size());
+}
+
+bool NanoPb::Converter::SharedBytesConverter::decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local) {
+    NANOPB_CPP_ASSERT(PB_LTYPE(field->type) == PB_LTYPE_BYTES);
+    const size_t len = stream->bytes_left;
+    const pb_byte_t* data = MemoryInputStream::getCurrentPosition(stream);
+    SharedBufferPtr buffer = data ? SharedInputStream::findBuffer(data, len) : nullptr;
+    if (buffer) {
+        local = SharedBytes(buffer, (const char *) data, len);
+        return pb_read(stream, NULL, len);
+    }
+
+    BufferType value;
+    if (!Type::Bytes::decode(stream, value))
+        return false;
+    local = SharedBytes(std::move(value));
+    return true;
+}
+
+/****************************************************************************************************************/
+
+bool NanoPb::Type::String::encode(pb_ostream_t *stream, const std::string &value) {
+    return pb_write(stream, (const pb_byte_t *) value.data(), value.size());
+}
+
+bool NanoPb::Type::String::decode(pb_istream_t *stream, std::string &value) {
+    const size_t len = stream->bytes_left;
+
+    // Copy directly from memory buffer: resize() would zero fill the string before pb_read() overwrites it.
+    const pb_byte_t* data = MemoryInputStream::getCurrentPosition(stream);
+    if (data) {
+        value.assign((const char*) data, len);
+        return pb_read(stream, NULL, len);
+    }
+
+    // Other streams are read in chunks and appended, so string is written only once.
+    value.clear();
+    value.reserve(len);
+    pb_byte_t buffer[256];
+    while (value.size() < len) {
+        const size_t chunk = std::min(len - value.size(), sizeof(buffer));
+        if (!pb_read(stream, buffer, chunk))
+            return false;
+        value.append((const char*) buffer, chunk);
+    }
+    return true;
 }
 
 /******************************************/
 
-bool NanoPb::Type::Double::encode(pb_ostream_t *stream, const double &value) {
-    return pb_encode_fixed64(stream, &value);
+bool NanoPb::Type::Bytes::encode(pb_ostream_t *stream, const std::string &value) {
+    return String::encode(stream, value);
 }
 
-bool NanoPb::Type::Double::decode(pb_istream_t *stream, double &value) {
-    return pb_decode_fixed64(stream, &value);
+bool NanoPb::Type::Bytes::decode(pb_istream_t *stream, std::string &value) {
+    return String::decode(stream, value);
 }
-#endif
 
 /****************************************************************************************************************/
@@ -3,6 +3,20 @@
 
 #include <string>
 #include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <tuple>
+#include <new>
+#include <type_traits>
+#include <iterator>
+#include <initializer_list>
+#include <cstring>
+#include <atomic>
+#if __cplusplus >= 201703L
+#include <string_view>
+#include <variant>
+#endif
 
 #include "pb.h"
 #include "pb_encode.h"
@@ -19,10 +33,19 @@
 #endif
 #endif
 
+/**
+ * Support of `decodeReuse()`: decode callbacks check for its active context, so all decodes pay for it.
+ * Should be same for all sources, see NANOPB_CPP_DECODE_REUSE CMake option.
+ */
+#ifndef NANOPB_CPP_DECODE_REUSE
+#define NANOPB_CPP_DECODE_REUSE 0
+#endif
+
 namespace NanoPb {
 
     using BufferType = std::string;
     using BufferPtr = std::unique_ptr<BufferType>;
+    using SharedBufferPtr = std::shared_ptr<const BufferType>;
 
     /**
      * StringOutputStream
@@ -41,130 +64,1404 @@ namespace NanoPb {
          *
          * @param maxStreamSize
          */
-        StringOutputStream(size_t maxStreamSize);
-        BufferPtr release();
+        StringOutputStream(size_t maxStreamSize);
+
+        /**
+         * Reserve buffer space for `size` more bytes, to avoid reallocations while writing.
+         * Reserved size is limited by max stream size.
+         */
+        void reserve(size_t size);
+
+        BufferPtr release();
+
+    public: // for internal use
+        /**
+         * @return `StringOutputStream`, which is written by the stream: stream itself or
+         *         its copy, created by nanopb for static sub message.
+         */
+        static StringOutputStream* _getStringStream(pb_ostream_t &stream);
+        size_t _getBufferSize() const;
+        /**
+         * Overwrite already written bytes.
+         *
+         * @param position - buffer size when bytes were written
+         */
+        void _overwrite(size_t position, const pb_byte_t *data, size_t size);
+
+    private:
+        static bool _pbCallback(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
+        BufferPtr _buffer;
+    };
+
+    /**
+     * MemoryInputStream
+     *
+     * Non-owning input stream over contiguous memory.
+     * Uses nanopb buffer reader: one memcpy() per read, skipping bytes just moves the position.
+     *
+     * NOTE: Memory should be alive until stream is in use.
+     */
+    class MemoryInputStream : public pb_istream_t {
+    public:
+        MemoryInputStream(const void* data, size_t size);
+
+        /**
+         * Get pointer to the next unread byte, if stream reads from contiguous memory.
+         * Works for MemoryInputStream, StringInputStream, pb_istream_from_buffer() and their substreams.
+         *
+         * @return pointer to the current position or NULL if stream is not a memory stream.
+         */
+        static const pb_byte_t* getCurrentPosition(const pb_istream_t* stream);
+    };
+
+    /**
+     * StringInputStream
+     *
+     * Same as MemoryInputStream, but owns the buffer.
+     */
+    class StringInputStream : public MemoryInputStream {
+    public:
+        StringInputStream(BufferPtr&& buffer);
+    private:
+        BufferPtr _buffer;
+    };
+
+    /**
+     * StringView
+     *
+     * Non-owning view of string/bytes field inside of the input buffer, see `StringViewConverter`.
+     * Converts to `std::string_view` in C++17.
+     *
+     * NOTE: Input buffer should be alive while view is in use.
+     */
+    class StringView {
+    public:
+        StringView() = default;
+        StringView(const char* data, size_t size) : _data(data), _size(size) {}
+        StringView(const std::string& str) : _data(str.data()), _size(str.size()) {}
+
+        const char* data() const { return _data; }
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+
+        std::string str() const { return std::string(_data, _size); }
+
+#if __cplusplus >= 201703L
+        operator std::string_view() const { return std::string_view(_data, _size); }
+#endif
+
+        bool operator==(const StringView& rhs) const {
+            return _size == rhs._size && (_size == 0 || memcmp(_data, rhs._data, _size) == 0);
+        }
+        bool operator!=(const StringView& rhs) const {
+            return !(*this == rhs);
+        }
+        bool operator<(const StringView& rhs) const {
+            // Default view has NULL data, which can't be passed to memcmp() even with zero size
+            const size_t size = _size < rhs._size ? _size : rhs._size;
+            const int result = size == 0 ? 0 : memcmp(_data, rhs._data, size);
+            return result < 0 || (result == 0 && _size < rhs._size);
+        }
+    private:
+        const char* _data = nullptr;
+        size_t _size = 0;
+    };
+
+    /**
+     * SharedInputStream
+     *
+     * Same as StringInputStream, but buffer is shared: `SharedBytesConverter` decodes slices,
+     * which keep the buffer alive after the stream is destroyed.
+     *
+     * Buffer is passed to converters by `decode()`/`decodeReuse()` overloads, which take SharedInputStream.
+     */
+    class SharedInputStream : public MemoryInputStream {
+    public:
+        SharedInputStream(BufferPtr&& buffer);
+        SharedInputStream(const SharedBufferPtr& buffer);
+        SharedInputStream(SharedInputStream&& other) = default;
+
+        SharedInputStream(const SharedInputStream&) = delete;
+        SharedInputStream& operator=(const SharedInputStream&) = delete;
+
+        const SharedBufferPtr& getBuffer() const { return _buffer; }
+
+        /**
+         * Get buffer of the shared input stream being decoded in the current thread, if it contains given memory.
+         *
+         * @return NULL if memory doesn't belong to the buffer or decoded stream is not shared.
+         */
+        static SharedBufferPtr findBuffer(const pb_byte_t* data, size_t size);
+
+    public: // for internal use
+        /**
+         * Make buffer of the stream active for the current thread while message is decoded.
+         */
+        class Scope {
+        public:
+            Scope(const SharedInputStream& stream);
+            ~Scope();
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+        private:
+            const SharedBufferPtr* _previous;
+        };
+
+    private:
+        SharedBufferPtr _buffer;
+    };
+
+    /**
+     * SharedBytes
+     *
+     * Slice of the shared buffer, see `SharedBytesConverter`.
+     * Slice keeps the buffer alive, so it can be passed to other threads without copying.
+     */
+    class SharedBytes {
+    public:
+        SharedBytes() = default;
+        SharedBytes(const SharedBufferPtr& buffer, const char* data, size_t size);
+        explicit SharedBytes(BufferType&& value);
+        explicit SharedBytes(const BufferType& value);
+
+        const char* data() const { return _data; }
+        size_t size() const { return _size; }
+        bool empty() const { return _size == 0; }
+        const SharedBufferPtr& getBuffer() const { return _buffer; }
+
+        std::string str() const { return std::string(_data, _size); }
+
+        bool operator==(const SharedBytes& rhs) const {
+            return _size == rhs._size && (_size == 0 || memcmp(_data, rhs._data, _size) == 0);
+        }
+        bool operator!=(const SharedBytes& rhs) const {
+            return !(*this == rhs);
+        }
+    private:
+        SharedBufferPtr _buffer;
+        const char* _data = nullptr;
+        size_t _size = 0;
+    };
+
+    /**
+     * DecodedMessage
+     *
+     * Memory of the message, which is being decoded by `decode()` from memory stream.
+     * Lets converters pre-scan fields of the message, see `Converter::Reserve::CountTags`.
+     */
+    class DecodedMessage {
+    public:
+        /**
+         * Count occurrences of the field with given wire type in the message being decoded.
+         *
+         * @return false if the field belongs to other message or message is not decoded from memory.
+         */
+        static bool countField(const pb_field_t *field, pb_wire_type_t wireType, size_t &count);
+
+    public: // for internal use
+        class Scope {
+        public:
+            Scope(const pb_istream_t &stream, const pb_msgdesc_t *fields);
+            ~Scope();
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+        private:
+            friend class DecodedMessage;
+            const pb_byte_t* _data;
+            size_t _size;
+            const pb_msgdesc_t* _fields;
+            Scope* _previous;
+        };
+    };
+
+    /**
+     * `DecodedMessage::Scope`, which is pushed only for messages with `Reserve::CountTags` fields,
+     * see `MessageConverter::countsFieldTags()`.
+     */
+    template<bool ENABLED>
+    class _DecodedMessageScope {
+    public:
+        _DecodedMessageScope(const pb_istream_t &stream, const pb_msgdesc_t *fields) {}
+    };
+
+    template<>
+    class _DecodedMessageScope<true> : public DecodedMessage::Scope {
+    public:
+        using DecodedMessage::Scope::Scope;
+    };
+
+    /**
+     * FieldMask
+     *
+     * Set of top level field numbers to decode, see `decode(stream, local, mask)`.
+     * Build it once and reuse: fields 1..64 are checked with a bit mask.
+     */
+    class FieldMask {
+    public:
+        FieldMask(std::initializer_list<uint32_t> tags);
+
+        bool contains(uint32_t tag) const;
+
+    public: // for internal use
+        /**
+         * Decode fields from the mask into initialized proto, skip other fields of the stream.
+         */
+        bool _decode(pb_istream_t &stream, const pb_msgdesc_t *fields, void *proto) const;
+
+    private:
+        uint64_t _bits = 0;
+        std::vector<uint32_t> _tags; // Sorted tags > 64
+    };
+
+    /**
+     * DecodeReuseContext
+     *
+     * State of `decodeReuse()` call: callback fields of the messages being decoded and decoded map items.
+     * Keep it between calls to reuse its memory too.
+     */
+    class DecodeReuseContext {
+    public:
+        DecodeReuseContext() = default;
+        DecodeReuseContext(const DecodeReuseContext&) = delete;
+        DecodeReuseContext& operator=(const DecodeReuseContext&) = delete;
+
+    public: // for internal use
+        using FinishCallback = void (*)(void* local, size_t count);
+
+        /**
+         * Make context active for the current thread. NULL context disables reuse.
+         */
+        class Scope {
+        public:
+            Scope(DecodeReuseContext* context);
+            ~Scope();
+        private:
+            DecodeReuseContext* _context;
+            DecodeReuseContext* _previous;
+        };
+
+        /**
+         * Callback fields registered while single message is decoded.
+         * finish() calls FinishCallback of each field to remove leftovers of the previous value.
+         */
+        class MessageScope {
+        public:
+            MessageScope(DecodeReuseContext& context);
+            ~MessageScope();
+            MessageScope(const MessageScope&) = delete;
+            MessageScope& operator=(const MessageScope&) = delete;
+
+            void finish();
+        private:
+            DecodeReuseContext* _context;
+            size_t _fieldsBegin = 0;
+            size_t _marksBegin = 0;
+            size_t _previousMarksBegin = 0;
+        };
+
+        static DecodeReuseContext* getActive();
+
+        /**
+         * True while any thread decodes with context, so other decodes don't look for the active context.
+         */
+        static bool isAnyActive(){ return _activeCount.load(std::memory_order_relaxed) != 0; }
+
+        size_t addField(void* local, FinishCallback finish);
+        void* getFieldLocal(size_t index) const;
+        size_t getFieldCount(size_t index) const;
+        void setFieldCount(size_t index, size_t count);
+
+        /**
+         * Mark container item as decoded in the current message
+         */
+        void mark(const void* container, const void* item);
+        bool isMarked(const void* container, const void* item) const;
+        size_t countMarks(const void* container) const;
+
+    private:
+        struct Field {
+            void* local;
+            size_t count;
+            FinishCallback finish;
+        };
+        using Mark = std::pair<const void*, const void*>;
+
+        std::vector<Field> _fields;
+        std::vector<Mark> _marks;
+        size_t _marksBegin = 0;
+
+        static std::atomic<unsigned> _activeCount;
+    };
+
+    /**
+     * EncodeSizeCache
+     *
+     * Cache of sub message sizes for single encode call.
+     * `pb_encode_submessage()` encodes each sub message twice: to get the size and to write it.
+     * With nested messages, deepest ones are encoded once per each nesting level.
+     * Encode with cache makes one sizing pass for the whole message, which stores size of each sub message,
+     * and one writing pass, which takes sizes from the cache. So each sub message is encoded twice at any depth.
+     * Static sub message fields are sized by nanopb itself, so they are encoded once more in writing pass.
+     *
+     * Cache can be reused between encode calls to keep its memory allocated.
+     * See `encode(stream, v, cache)`.
+     */
+    class EncodeSizeCache {
+    public:
+        EncodeSizeCache() = default;
+        EncodeSizeCache(const EncodeSizeCache&) = delete;
+        EncodeSizeCache& operator=(const EncodeSizeCache&) = delete;
+
+    public: // for internal use
+        class Scope {
+        public:
+            Scope(EncodeSizeCache& cache);
+            ~Scope();
+        private:
+            EncodeSizeCache* _previous;
+        };
+
+        void startWriting();
+        static EncodeSizeCache* getActive();
+        bool _encodeSubMessage(pb_ostream_t &stream, const pb_msgdesc_t *fields, const void *src, const void *key);
+
+    private:
+        struct Entry {
+            const void* key;
+            const pb_msgdesc_t* fields;
+            size_t size;
+        };
+
+        bool _find(const void *key, const pb_msgdesc_t *fields, size_t& size);
+        bool _findIndexed(const void *key, const pb_msgdesc_t *fields, size_t& index);
+        bool _encodeSized(pb_ostream_t &stream, const pb_msgdesc_t *fields, const void *src, const void *key);
+        bool _encodeWithSize(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src, size_t size);
+
+        std::vector<Entry> _entries;
+        std::vector<size_t> _index; // Entries indexes sorted by key, built on the first out of order lookup
+        size_t _position = 0;
+        bool _writing = false;
+    };
+
+    /**
+     * Single pass encoding of the root stream for the duration of `encodeSinglePass()` call.
+     */
+    class _SinglePassScope {
+    public:
+        _SinglePassScope(pb_ostream_t &stream);
+        ~_SinglePassScope();
+
+        static bool isSupported(pb_ostream_t &stream);
+        static bool isActive(const pb_ostream_t &stream);
+        static bool encodeSubMessage(pb_ostream_t &stream, const pb_msgdesc_t *fields, const void *src);
+
+    private:
+        pb_ostream_t* _previous;
+    };
+
+    /**
+     * Encode sub message with size prefix.
+     *
+     * Depending on the current encode call uses:
+     *  - single pass encoding, see `encodeSinglePass()`
+     *  - size cache, see `EncodeSizeCache`
+     *  - `pb_encode_submessage()` otherwise.
+     *
+     * @param key - address of the local object, which is the source of the message.
+     *              Must be the same for sizing and writing pass.
+     */
+    bool encodeSubMessage(pb_ostream_t &stream, const pb_msgdesc_t *fields, const void *src, const void *key);
+
+    /**
+     * Encoded field tag
+     *
+     *  Constructor is constexpr, so tag of the known field can be computed at compile time:
+     *
+     *      static constexpr FieldTag tag(PROTO_TestMessage_number_tag, PB_WT_VARINT);
+     *
+     *  Converters are not bound to field numbers, so they get tag from `field->tag` at runtime.
+     *  Repeated field converters compute it once per callback and write it before each item, see `EncodeItemValue`.
+     */
+    class FieldTag {
+    public:
+        constexpr FieldTag(uint32_t tag, pb_wire_type_t wireType) :
+            FieldTag(((uint64_t) tag << 3) | wireType) {}
+
+        bool write(pb_ostream_t *stream) const { return pb_write(stream, _bytes, _size); }
+
+        constexpr size_t size() const { return _size; }
+        const pb_byte_t* data() const { return _bytes; }
+
+    private:
+        constexpr explicit FieldTag(uint64_t value) :
+            _bytes{_byte(value, 0), _byte(value, 1), _byte(value, 2), _byte(value, 3), _byte(value, 4)},
+            _size(_length(value)) {}
+
+        static constexpr pb_byte_t _byte(uint64_t value, unsigned index){
+            return (pb_byte_t) (((value >> (7 * index)) & 0x7F) | ((value >> (7 * (index + 1))) ? 0x80 : 0));
+        }
+        static constexpr uint8_t _length(uint64_t value){
+            return value < 0x80 ? 1 : 1 + _length(value >> 7);
+        }
+
+        pb_byte_t _bytes[5];
+        uint8_t _size;
+    };
+
+    /**
+     * Decode block of varints from memory.
+     *
+     *  Stops before first varint, which is truncated, longer than 10 bytes or larger than `maxValue`,
+     *  so it can be decoded (or rejected) by nanopb.
+     *
+     * @param count - in: capacity of `values`, out: number of decoded values
+     * @return number of consumed bytes
+     */
+    size_t decodeVarints(const pb_byte_t *data, size_t size, pb_uint64_t maxValue, pb_uint64_t *values, size_t &count);
+
+    /**
+     * Get encoded size of varints block
+     */
+    size_t encodedVarintsSize(const pb_uint64_t *values, size_t count);
+
+    /**
+     * Encode block of varints with single pb_write() per staging buffer
+     */
+    bool encodeVarints(pb_ostream_t *stream, const pb_uint64_t *values, size_t count);
+
+    /**
+     * Encode message
+     */
+    template<class MESSAGE_CONVERTER>
+    bool encode(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using LocalType = typename MESSAGE_CONVERTER::LocalType;
+
+        const LocalType& local = v;
+        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
+
+        return pb_encode(&stream, MESSAGE_CONVERTER::getMsgType(), &proto);
+    }
+
+    /**
+     * Get encoded size of the message
+     */
+    template<class MESSAGE_CONVERTER>
+    bool encodedSize(const typename MESSAGE_CONVERTER::LocalType& v, size_t& size){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using LocalType = typename MESSAGE_CONVERTER::LocalType;
+
+        const LocalType& local = v;
+        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
+
+        return pb_get_encoded_size(&size, MESSAGE_CONVERTER::getMsgType(), &proto);
+    }
+
+    /**
+     * Encode message to the string stream and reserve buffer before writing.
+     * Use `encodedSize()` to get exact size and avoid buffer reallocations.
+     */
+    template<class MESSAGE_CONVERTER>
+    bool encode(StringOutputStream &stream, const typename MESSAGE_CONVERTER::LocalType& v, size_t reserveSize){
+        stream.reserve(reserveSize);
+        return encode<MESSAGE_CONVERTER>(stream, v);
+    }
+
+    /**
+     * Encode sub message
+     */
+    template<class MESSAGE_CONVERTER>
+    bool encodeSubMessage(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using LocalType = typename MESSAGE_CONVERTER::LocalType;
+
+        const LocalType& local = v;
+        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
+
+        return encodeSubMessage(stream, MESSAGE_CONVERTER::getMsgType(), &proto, &local);
+    }
+
+    /**
+     * Encode message with sub message size cache.
+     * Makes sense for messages with deep nesting, see `EncodeSizeCache` for the details.
+     */
+    template<class MESSAGE_CONVERTER>
+    bool encode(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v, EncodeSizeCache& cache){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using LocalType = typename MESSAGE_CONVERTER::LocalType;
+
+        const LocalType& local = v;
+        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
+
+        EncodeSizeCache::Scope scope(cache);
+
+        pb_ostream_t sizingStream = PB_OSTREAM_SIZING;
+        if (!pb_encode(&sizingStream, MESSAGE_CONVERTER::getMsgType(), &proto))
+            return false;
+
+        cache.startWriting();
+
+        return pb_encode(&stream, MESSAGE_CONVERTER::getMsgType(), &proto);
+    }
+
+    /**
+     * Encode message in single pass.
+     *
+     * Each sub message, encoded by converter, is written once: 5 bytes are reserved for its length prefix
+     * and filled after the sub message, when its size is known, so written data is never moved.
+     * Length is written as padded (non-canonical) varint: output is valid for any protobuf decoder,
+     * but it's not byte-identical to `encode()` and each sub message takes up to 4 bytes more.
+     * Static sub messages of the proto are sized by nanopb `pb_encode_submessage()`, so they are encoded twice,
+     * sub messages inside them are written in single pass in both nanopb passes.
+     * Makes sense for messages with deep nesting.
+     *
+     * @param stream - `StringOutputStream`, nanopb buffer stream `pb_ostream_from_buffer()`
+     *                 or sizing stream `PB_OSTREAM_SIZING` to get size of the single pass encoding.
+     */
+    template<class MESSAGE_CONVERTER>
+    bool encodeSinglePass(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using LocalType = typename MESSAGE_CONVERTER::LocalType;
+
+        if (!_SinglePassScope::isSupported(stream)) {
+            pb_ostream_t* pStream = &stream;
+            PB_RETURN_ERROR(pStream, "stream doesn't support single pass");
+        }
+
+        const LocalType& local = v;
+        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
+
+        _SinglePassScope scope(stream);
+        return pb_encode(&stream, MESSAGE_CONVERTER::getMsgType(), &proto);
+    }
+
+    /**
+     * UnionTable
+     *
+     * Lookup table of sub message fields of the union container: tag -> sub message descriptor and back.
+     * Built once, so union encode/decode doesn't walk field descriptors for each message.
+     */
+    class UnionTable {
+    public:
+        explicit UnionTable(const pb_msgdesc_t* unionContainer);
+
+        UnionTable(const UnionTable&) = delete;
+        UnionTable& operator=(const UnionTable&) = delete;
+
+        /**
+         * Table of the union container, built once on the first call and shared by all threads.
+         * Prefer `get<UNION_CONTAINER>()` when descriptor is known at compile time: it skips the hash lookup.
+         */
+        static const UnionTable& get(const pb_msgdesc_t* unionContainer);
+
+        /**
+         * Table of the union container, which is a static of the template instantiation.
+         */
+        template<const pb_msgdesc_t* UNION_CONTAINER>
+        static const UnionTable& get(){
+            static const UnionTable table(UNION_CONTAINER);
+            return table;
+        }
+
+        const pb_msgdesc_t* getUnionContainer() const { return _unionContainer; }
+
+        /**
+         * @return sub message descriptor of the field or NULL if field isn't a sub message.
+         */
+        const pb_msgdesc_t* findMessageType(uint32_t tag) const;
+
+        /**
+         * @return tag of the field with given sub message or 0 if not found.
+         */
+        uint32_t findTag(const pb_msgdesc_t* messageType) const;
+
+    private:
+        using TagEntry = std::pair<uint32_t, const pb_msgdesc_t*>;
+        using TypeEntry = std::pair<const pb_msgdesc_t*, uint32_t>;
+
+        const pb_msgdesc_t* _unionContainer;
+        uint32_t _minTag = 0;
+        std::vector<const pb_msgdesc_t*> _dense; // Indexed by (tag - _minTag), empty if tags are sparse
+        std::vector<TagEntry> _tags; // Sorted by tag
+        std::vector<TypeEntry> _types; // Sorted by descriptor
+    };
+
+    /**
+     * Encode union message
+     */
+    template<class MESSAGE_CONVERTER>
+    bool encodeUnionMessage(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v, const UnionTable& table){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using LocalType = typename MESSAGE_CONVERTER::LocalType;
+
+        const uint32_t tag = table.findTag(MESSAGE_CONVERTER::getMsgType());
+        /* Didn't find the field for messagetype */
+        if (tag == 0)
+            return false;
+
+        const LocalType& local = v;
+        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
+
+        if (!pb_encode_tag(&stream, PB_WT_STRING, tag))
+            return false;
+        return encodeSubMessage(stream, MESSAGE_CONVERTER::getMsgType(), &proto, &local);
+    }
+
+    /**
+     * Encode union message
+     */
+    template<class MESSAGE_CONVERTER>
+    bool encodeUnionMessage(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v, const pb_msgdesc_t* unionContainer){
+        return encodeUnionMessage<MESSAGE_CONVERTER>(stream, v, UnionTable::get(unionContainer));
+    }
+
+    /**
+     * Encode union message, union container is known at compile time
+     */
+    template<class MESSAGE_CONVERTER, const pb_msgdesc_t* UNION_CONTAINER>
+    bool encodeUnionMessage(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v){
+        return encodeUnionMessage<MESSAGE_CONVERTER>(stream, v, UnionTable::get<UNION_CONTAINER>());
+    }
+
+    /**
+     * Decode message from stream
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decode(pb_istream_t &stream, typename MESSAGE_CONVERTER::LocalType& v){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using DecoderContext = typename MESSAGE_CONVERTER::DecoderContext;
+
+        _DecodedMessageScope<MESSAGE_CONVERTER::countsFieldTags()> scope(stream, MESSAGE_CONVERTER::getMsgType());
+
+        DecoderContext local = v;
+        ProtoType proto = MESSAGE_CONVERTER::decoderInit(local);
+
+        if (!pb_decode(&stream, MESSAGE_CONVERTER::getMsgType(), &proto))
+            return false;
+        if (!MESSAGE_CONVERTER::decoderApply(proto, local))
+            return false;
+        return true;
+    }
+
+    /**
+     * Decode message into existing object with active context, see `decodeReuse()`.
+     * Callback fields of the message are registered in the context and finished after decoding.
+     */
+    template<class MESSAGE_CONVERTER>
+    bool _decodeReuse(pb_istream_t &stream, typename MESSAGE_CONVERTER::LocalType& v, DecodeReuseContext& context){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using DecoderContext = typename MESSAGE_CONVERTER::DecoderContext;
+
+        _DecodedMessageScope<MESSAGE_CONVERTER::countsFieldTags()> scope(stream, MESSAGE_CONVERTER::getMsgType());
+        DecodeReuseContext::MessageScope reuseScope(context);
+
+        DecoderContext local = v;
+        ProtoType proto = MESSAGE_CONVERTER::decoderInit(local);
+
+        if (!pb_decode(&stream, MESSAGE_CONVERTER::getMsgType(), &proto))
+            return false;
+        reuseScope.finish();
+        if (!MESSAGE_CONVERTER::decoderApply(proto, local))
+            return false;
+        return true;
+    }
+
+    /**
+     * Decode only fields from the mask.
+     *
+     * Other fields are skipped at wire level: their data isn't decoded and their converters aren't called.
+     * Fields from the mask are decoded by nanopb into proto from decoderInit() without resetting it,
+     * so fields outside of the mask and fields missing in the message keep values set by decoderInit().
+     * Memory stream is decoded in place, by runs of consecutive fields from the mask.
+     *
+     * NOTE: Required fields (proto2) are not checked.
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decode(pb_istream_t &stream, typename MESSAGE_CONVERTER::LocalType& v, const FieldMask& mask){
+        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+        using DecoderContext = typename MESSAGE_CONVERTER::DecoderContext;
+
+        _DecodedMessageScope<MESSAGE_CONVERTER::countsFieldTags()> scope(stream, MESSAGE_CONVERTER::getMsgType());
+
+        DecoderContext local = v;
+        ProtoType proto = MESSAGE_CONVERTER::decoderInit(local);
+
+        if (!mask._decode(stream, MESSAGE_CONVERTER::getMsgType(), &proto))
+            return false;
+        if (!MESSAGE_CONVERTER::decoderApply(proto, local))
+            return false;
+        return true;
+    }
+
+    /**
+     * Decode only fields from the mask from buffer in memory, see `decode(stream, local, mask)`
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decode(const void* data, const size_t dataSize, typename MESSAGE_CONVERTER::LocalType& v, const FieldMask& mask){
+        MemoryInputStream stream(data, dataSize);
+        return decode<MESSAGE_CONVERTER>(stream, v, mask);
+    }
+
+    /**
+     * Decode message into existing object.
+     *
+     * Strings, arrays and maps of the object are overwritten in place to keep their memory,
+     * leftovers of the previous value are removed when each message is decoded.
+     * Reuse same `context` between calls to make steady state decode without heap allocations.
+     *
+     * NOTE: decoderApply() should assign all fields, which are not decoded by callbacks.
+     * NOTE: Custom callback converters can implement decodeReuseCallback()/decodeReuseFinish(), see CallbackConverter.
+     * NOTE: Requires NANOPB_CPP_DECODE_REUSE.
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decodeReuse(pb_istream_t &stream, typename MESSAGE_CONVERTER::LocalType& v, DecodeReuseContext& context){
+        // Depends on template parameter, so it fails only if decodeReuse() is used
+        static_assert(NANOPB_CPP_DECODE_REUSE || sizeof(MESSAGE_CONVERTER) == 0, "decodeReuse() requires NANOPB_CPP_DECODE_REUSE");
+        DecodeReuseContext::Scope scope(&context);
+        return _decodeReuse<MESSAGE_CONVERTER>(stream, v, context);
+    }
+
+    /**
+     * Decode message from buffer in memory into existing object, see `decodeReuse(stream, v, context)`
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decodeReuse(const void* data, const size_t dataSize, typename MESSAGE_CONVERTER::LocalType& v, DecodeReuseContext& context){
+        MemoryInputStream stream(data, dataSize);
+        return decodeReuse<MESSAGE_CONVERTER>(stream, v, context);
+    }
+
+    /**
+     * Decode from buffer in memory
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decode(const void* data, const size_t dataSize, typename MESSAGE_CONVERTER::LocalType& v){
+        MemoryInputStream stream(data, dataSize);
+        return decode<MESSAGE_CONVERTER>(stream, v);
+    }
+
+    /**
+     * Decode from shared buffer: `SharedBytesConverter` decodes slices of the buffer.
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decode(SharedInputStream &stream, typename MESSAGE_CONVERTER::LocalType& v){
+        SharedInputStream::Scope scope(stream);
+        return decode<MESSAGE_CONVERTER>(static_cast<pb_istream_t&>(stream), v);
+    }
+
+    /**
+     * Decode only fields from the mask from shared buffer, see `decode(stream, local, mask)`
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decode(SharedInputStream &stream, typename MESSAGE_CONVERTER::LocalType& v, const FieldMask& mask){
+        SharedInputStream::Scope scope(stream);
+        return decode<MESSAGE_CONVERTER>(static_cast<pb_istream_t&>(stream), v, mask);
+    }
+
+    /**
+     * Decode from shared buffer into existing object, see `decodeReuse(stream, v, context)`
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decodeReuse(SharedInputStream &stream, typename MESSAGE_CONVERTER::LocalType& v, DecodeReuseContext& context){
+        SharedInputStream::Scope scope(stream);
+        return decodeReuse<MESSAGE_CONVERTER>(static_cast<pb_istream_t&>(stream), v, context);
+    }
+
+    /**
+     * Decode sub message
+     */
+    template<class MESSAGE_CONVERTER>
+    bool decodeSubMessage(pb_istream_t &stream, typename MESSAGE_CONVERTER::LocalType& v){
+        pb_istream_t subStream;
+
+        if (!pb_make_string_substream(&stream, &subStream))
+            return false;
+
+        if (!decode<MESSAGE_CONVERTER>(subStream, v))
+            return false;
+
+        if (!pb_close_string_substream(&stream, &subStream))
+            return false;
+        return true;
+    }
+
+    /**
+     * Decode union message type
+     */
+    const pb_msgdesc_t* decodeUnionMessageType(pb_istream_t &stream, const pb_msgdesc_t* unionContainer);
+
+    /**
+     * Decode union message type
+     */
+    const pb_msgdesc_t* decodeUnionMessageType(pb_istream_t &stream, const UnionTable& table);
+
+    /**
+     * Decode union message type, union container is known at compile time
+     */
+    template<const pb_msgdesc_t* UNION_CONTAINER>
+    const pb_msgdesc_t* decodeUnionMessageType(pb_istream_t &stream){
+        return decodeUnionMessageType(stream, UnionTable::get<UNION_CONTAINER>());
+    }
+
+    /**
+     * UnionCase
+     *
+     * Variant of `decodeUnion()`: converter of the union sub message and handler of decoded message.
+     * Use `NanoPb::unionCase<CONVERTER>(handler)` to create it.
+     *
+     * @tparam CONVERTER - Converter of the union sub message
+     * @tparam HANDLER - Callable with signature `void(CONVERTER::LocalType&)`
+     */
+    template<class CONVERTER, class HANDLER>
+    class UnionCase {
+    public:
+        explicit UnionCase(HANDLER handler) : _handler(std::move(handler)) {}
+
+    public: // for internal use
+        static const pb_msgdesc_t* getMsgType() { return CONVERTER::getMsgType(); }
+
+        bool decode(pb_istream_t &stream) {
+            typename CONVERTER::LocalType local;
+            if (!decodeSubMessage<CONVERTER>(stream, local))
+                return false;
+            _handler(local);
+            return true;
+        }
+
+    private:
+        HANDLER _handler;
+    };
+
+    template<class CONVERTER, class HANDLER>
+    UnionCase<CONVERTER, typename std::decay<HANDLER>::type> unionCase(HANDLER&& handler){
+        return UnionCase<CONVERTER, typename std::decay<HANDLER>::type>(std::forward<HANDLER>(handler));
+    }
+
+    inline bool _decodeUnionCase(pb_istream_t &stream, const pb_msgdesc_t* type, bool& handled){
+        return false;
+    }
+
+    template<class CASE, class... CASES>
+    bool _decodeUnionCase(pb_istream_t &stream, const pb_msgdesc_t* type, bool& handled, CASE& unionCase, CASES&... cases){
+        if (CASE::getMsgType() == type) {
+            handled = true;
+            return unionCase.decode(stream);
+        }
+        return _decodeUnionCase(stream, type, handled, cases...);
+    }
+
+    /**
+     * Decode union message in single pass: first union field with matching case is decoded
+     * directly from the stream and passed to the case handler. Fields before it are skipped, fields after it aren't read.
+     * Works with any stream, stream doesn't need to be rewound like with `decodeUnionMessageType()`.
+     *
+     * Usage:
+     *
+     *      NanoPb::decodeUnion(stream, &PROTO_UnionContainer_msg,
+     *          NanoPb::unionCase<UnionInnerOneConverter>([&](UnionInnerOne& message){ ... }),
+     *          NanoPb::unionCase<UnionInnerTwoConverter>([&](UnionInnerTwo& message){ ... })
+     *      );
+     *
+     * @return false if there is no union message with matching case or decode failed.
+     */
+    template<class... CASES>
+    bool decodeUnion(pb_istream_t &stream, const UnionTable& table, CASES&&... cases){
+        pb_wire_type_t wire_type;
+        uint32_t tag;
+        bool eof;
+
+        while (pb_decode_tag(&stream, &wire_type, &tag, &eof))
+        {
+            const pb_msgdesc_t* type = (wire_type == PB_WT_STRING) ? table.findMessageType(tag) : NULL;
+            if (type) {
+                bool handled = false;
+                const bool status = _decodeUnionCase(stream, type, handled, cases...);
+                if (handled)
+                    return status;
+            }
+            if (!pb_skip_field(&stream, wire_type))
+                return false;
+        }
+
+        if (eof) {
+            pb_istream_t* pStream = &stream;
+            PB_RETURN_ERROR(pStream, "no union message");
+        }
+        return false;
+    }
+
+    template<class... CASES>
+    bool decodeUnion(pb_istream_t &stream, const pb_msgdesc_t* unionContainer, CASES&&... cases){
+        return decodeUnion(stream, UnionTable::get(unionContainer), std::forward<CASES>(cases)...);
+    }
+
+    /**
+     * Decode union message in single pass, union container is known at compile time:
+     * `NanoPb::decodeUnion<&PROTO_UnionContainer_msg>(stream, cases...)`
+     */
+    template<const pb_msgdesc_t* UNION_CONTAINER, class... CASES>
+    bool decodeUnion(pb_istream_t &stream, CASES&&... cases){
+        return decodeUnion(stream, UnionTable::get<UNION_CONTAINER>(), std::forward<CASES>(cases)...);
+    }
+
+    /**
+     * Call decode callback of the CONVERTER until whole field value is read.
+     *
+     * @return false if callback fails or doesn't read anything.
+     */
+    template<class CONVERTER>
+    bool _decodeFieldValue(pb_istream_t &stream, const pb_field_iter_t &field, typename CONVERTER::LocalType& value){
+        // Empty value is decoded too, as nanopb does
+        size_t previous;
+        do {
+            previous = stream.bytes_left;
+            if (!CONVERTER::decodeCallback(&stream, &field, value))
+                return false;
+        } while (stream.bytes_left && stream.bytes_left < previous);
+
+        if (stream.bytes_left) {
+            pb_istream_t* pStream = &stream;
+            PB_RETURN_ERROR(pStream, "callback didn't read value");
+        }
+        return true;
+    }
+
+    /**
+     * FieldIndex
+     *
+     * Offsets of the top level fields of encoded message, built in one pass over the buffer.
+     * Lets decode single field or element of the repeated field without decoding whole message.
+     *
+     * NOTE: Buffer should be alive while index is in use.
+     */
+    class FieldIndex {
+    public:
+        struct Entry {
+            uint32_t tag;
+            pb_wire_type_t wireType;
+            size_t offset; // Offset of the value in the buffer, after length prefix for PB_WT_STRING
+            size_t size;
+        };
+
+        /**
+         * Scan encoded message with given descriptor.
+         *
+         * @return false if message is malformed.
+         */
+        bool build(const void* data, size_t size, const pb_msgdesc_t* fields);
+
+        /**
+         * Number of occurrences of the field in the message: number of elements of unpacked repeated field.
+         */
+        size_t count(uint32_t tag) const;
+
+        /**
+         * Find `index` occurrence of the field.
+         *
+         * @return NULL if not found.
+         */
+        const Entry* find(uint32_t tag, size_t index = 0) const;
+
+        /**
+         * Decode `index` occurrence of the field with callback converter (e.g. item converter of the array).
+         */
+        template<class CONVERTER>
+        bool decodeField(uint32_t tag, size_t index, typename CONVERTER::LocalType& value) const {
+            pb_field_iter_t field;
+            pb_istream_t stream;
+            if (!_getField(tag, index, field, stream))
+                return false;
+            return _decodeFieldValue<CONVERTER>(stream, field, value);
+        }
+
+    private:
+        bool _getField(uint32_t tag, size_t index, pb_field_iter_t& field, pb_istream_t& stream) const;
+
+        const pb_byte_t* _data = nullptr;
+        const pb_msgdesc_t* _fields = nullptr;
+        std::vector<Entry> _entries; // Sorted by tag, occurrences keep message order
+    };
+
+    /**
+     * Find field by path of field numbers in encoded message, see `extract()`.
+     *
+     * @param field - descriptor of the last field in the path
+     * @param value - stream over the value of the last field occurrence (payload for PB_WT_STRING)
+     */
+    bool findField(const void* data, size_t size, const pb_msgdesc_t* fields, std::initializer_list<uint32_t> path,
+                   pb_field_iter_t& field, pb_istream_t& value);
+
+    /**
+     * Decode single field by path of field numbers, e.g. {1, 3} for `message.header.tenant_id`,
+     * without decoding the rest of the message. Other fields are skipped, only the leaf is decoded by callback CONVERTER.
+     * Occurrences of non-repeated sub messages are merged as protobuf does, otherwise the last occurrence is used.
+     *
+     * @param fields - descriptor of the root message
+     * @return false if field is missing or message is malformed.
+     */
+    template<class CONVERTER>
+    bool extract(const void* data, size_t size, const pb_msgdesc_t* fields, std::initializer_list<uint32_t> path,
+                 typename CONVERTER::LocalType& value){
+        pb_field_iter_t field;
+        pb_istream_t stream;
+        if (!findField(data, size, fields, path, field, stream))
+            return false;
+        return _decodeFieldValue<CONVERTER>(stream, field, value);
+    }
+
+    /**
+     * FieldFilter
+     *
+     * Set of fields of the given message types, see `stripFields()`.
+     */
+    class FieldFilter {
+    public:
+        using Field = std::pair<const pb_msgdesc_t*, uint32_t>;
+
+        FieldFilter(std::initializer_list<Field> fields);
+
+        bool contains(const pb_msgdesc_t* message, uint32_t tag) const;
+
+    private:
+        std::vector<Field> _fields; // Sorted
+    };
+
+    /**
+     * Copy encoded message from input to output without fields from the filter, at any nesting depth.
+     * Message is transcoded at wire level, length prefixes of sub messages are rewritten.
+     * Sub messages without filtered fields and unknown fields are copied as is.
+     *
+     * @param fields - descriptor of the root message
+     */
+    bool stripFields(pb_istream_t &input, pb_ostream_t &output, const pb_msgdesc_t* fields, const FieldFilter& filter);
+
+    template<class T, class... TYPES>
+    struct _TypeIndex;
+
+    template<class T, class... TYPES>
+    struct _TypeIndex<T, T, TYPES...> : std::integral_constant<int, 0> {};
+
+    template<class T, class U, class... TYPES>
+    struct _TypeIndex<T, U, TYPES...> : std::integral_constant<int, 1 + _TypeIndex<T, TYPES...>::value> {};
+
+    template<class... TYPES>
+    struct _MaxSizeOf : std::integral_constant<size_t, 0> {};
+
+    template<class T, class... TYPES>
+    struct _MaxSizeOf<T, TYPES...> : std::integral_constant<size_t,
+            (sizeof(T) > _MaxSizeOf<TYPES...>::value) ? sizeof(T) : _MaxSizeOf<TYPES...>::value> {};
+
+    template<class... TYPES>
+    struct _MaxAlignOf : std::integral_constant<size_t, 1> {};
+
+    template<class T, class... TYPES>
+    struct _MaxAlignOf<T, TYPES...> : std::integral_constant<size_t,
+            (alignof(T) > _MaxAlignOf<TYPES...>::value) ? alignof(T) : _MaxAlignOf<TYPES...>::value> {};
+
+    /**
+     * InlineVariant
+     *
+     * Tagged union of given types stored inline, without heap allocation. Empty by default.
+     * Used by `Converter::UnionVariantConverter` to decode union (oneof) messages.
+     */
+    template<class... TYPES>
+    class InlineVariant {
+    public:
+        InlineVariant() = default;
+        InlineVariant(const InlineVariant&) = delete;
+        InlineVariant& operator=(const InlineVariant&) = delete;
+
+        InlineVariant(InlineVariant&& other) {
+            _moveFrom(other);
+        }
+
+        InlineVariant& operator=(InlineVariant&& other) {
+            if (this != &other) {
+                reset();
+                _moveFrom(other);
+            }
+            return *this;
+        }
+
+        template<class T>
+        InlineVariant(T&& value, typename std::enable_if<!std::is_same<typename std::decay<T>::type, InlineVariant>::value>::type* = nullptr) {
+            emplace<typename std::decay<T>::type>(std::forward<T>(value));
+        }
+
+        ~InlineVariant() {
+            reset();
+        }
+
+        /**
+         * @return index of the stored type in TYPES or -1 if empty.
+         */
+        int index() const { return _index; }
+
+        bool empty() const { return _index < 0; }
+
+        template<class T>
+        bool is() const { return _index == _TypeIndex<T, TYPES...>::value; }
+
+        /**
+         * @return stored value or nullptr if other type is stored.
+         */
+        template<class T>
+        T* get() { return is<T>() ? reinterpret_cast<T*>(_storage) : nullptr; }
+
+        template<class T>
+        const T* get() const { return is<T>() ? reinterpret_cast<const T*>(_storage) : nullptr; }
+
+        template<class T, class... ARGS>
+        T& emplace(ARGS&&... args) {
+            reset();
+            T* value = new (_storage) T(std::forward<ARGS>(args)...);
+            _index = _TypeIndex<T, TYPES...>::value;
+            return *value;
+        }
+
+        void reset() {
+            static void (*const destroy[])(void*) = { &_destroy<TYPES>... };
+            if (_index >= 0)
+                destroy[_index](_storage);
+            _index = -1;
+        }
+
     private:
-        static bool _pbCallback(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
-        BufferPtr _buffer;
-    };
+        template<class T>
+        static void _destroy(void* value) { static_cast<T*>(value)->~T(); }
+
+        template<class T>
+        static void _move(void* to, void* from) { new (to) T(std::move(*static_cast<T*>(from))); }
+
+        void _moveFrom(InlineVariant& other) {
+            static void (*const move[])(void*, void*) = { &_move<TYPES>... };
+            if (other._index >= 0) {
+                move[other._index](_storage, other._storage);
+                _index = other._index;
+                other.reset();
+            }
+        }
 
-    /**
-     * StringInputStream
-     */
-    class StringInputStream : public pb_istream_t {
-    public:
-        StringInputStream(BufferPtr&& buffer);
     private:
-        BufferPtr _buffer;
-        size_t _position;
+        alignas(_MaxAlignOf<TYPES...>::value) unsigned char _storage[_MaxSizeOf<TYPES...>::value];
+        int _index = -1;
     };
 
     /**
-     * Encode message
+     * Access to the variant type for `Converter::UnionVariantConverter`.
+     * Specialized for `NanoPb::InlineVariant` and `std::variant` (C++17), specialize it for other variant types.
      */
-    template<class MESSAGE_CONVERTER>
-    bool encode(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v){
-        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
-        using LocalType = typename MESSAGE_CONVERTER::LocalType;
-
-        const LocalType& local = v;
-        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
+    template<class VARIANT>
+    struct VariantTraits;
+
+    template<class... TYPES>
+    struct VariantTraits<InlineVariant<TYPES...>> {
+        using VariantType = InlineVariant<TYPES...>;
+        using Types = std::tuple<TYPES...>;
+
+        static int index(const VariantType& variant) { return variant.index(); }
+        template<class T>
+        static T& get(VariantType& variant) { return *variant.template get<T>(); }
+        template<class T>
+        static const T& get(const VariantType& variant) { return *variant.template get<T>(); }
+        template<class T>
+        static T& emplace(VariantType& variant) { return variant.template emplace<T>(); }
+        static void reset(VariantType& variant) { variant.reset(); }
+    };
 
-        return pb_encode(&stream, MESSAGE_CONVERTER::getMsgType(), &proto);
-    }
+#if __cplusplus >= 201703L
+    template<class... TYPES>
+    struct VariantTraits<std::variant<TYPES...>> {
+        using VariantType = std::variant<TYPES...>;
+        using Types = std::tuple<TYPES...>;
+
+        static int index(const VariantType& variant) { return variant.valueless_by_exception() ? -1 : (int) variant.index(); }
+        template<class T>
+        static T& get(VariantType& variant) { return *std::get_if<T>(&variant); }
+        template<class T>
+        static const T& get(const VariantType& variant) { return *std::get_if<T>(&variant); }
+        template<class T>
+        static T& emplace(VariantType& variant) { return variant.template emplace<T>(); }
+        // std::variant can't be empty, first type is default
+        static void reset(VariantType& variant) { variant.template emplace<0>(); }
+    };
 
     /**
-     * Encode sub message
+     * `std::monostate` as the first type is the empty state: it's encoded as no union member (`which_xxx == 0`),
+     * so CASES converters match the rest of the types.
      */
-    template<class MESSAGE_CONVERTER>
-    bool encodeSubMessage(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v){
-        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
-        using LocalType = typename MESSAGE_CONVERTER::LocalType;
-
-        const LocalType& local = v;
-        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
-
-        return pb_encode_submessage(&stream, MESSAGE_CONVERTER::getMsgType(), &proto);
-    }
+    template<class... TYPES>
+    struct VariantTraits<std::variant<std::monostate, TYPES...>> {
+        using VariantType = std::variant<std::monostate, TYPES...>;
+        using Types = std::tuple<TYPES...>;
+
+        static int index(const VariantType& variant) { return variant.valueless_by_exception() ? -1 : (int) variant.index() - 1; }
+        template<class T>
+        static T& get(VariantType& variant) { return *std::get_if<T>(&variant); }
+        template<class T>
+        static const T& get(const VariantType& variant) { return *std::get_if<T>(&variant); }
+        template<class T>
+        static T& emplace(VariantType& variant) { return variant.template emplace<T>(); }
+        static void reset(VariantType& variant) { variant.template emplace<std::monostate>(); }
+    };
+#endif
 
     /**
-     * Encode union message
+     * LazyMessage
+     *
+     * Sub message, which is decoded on the first access, see `Converter::LazyMessageConverter`.
+     * Encoded bytes are kept until message is modified, so untouched message is encoded back verbatim.
      */
     template<class MESSAGE_CONVERTER>
-    bool encodeUnionMessage(pb_ostream_t &stream, const typename MESSAGE_CONVERTER::LocalType& v, const pb_msgdesc_t* unionContainer){
-        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
+    class LazyMessage {
+    public:
         using LocalType = typename MESSAGE_CONVERTER::LocalType;
 
-        pb_field_iter_t iter;
-
-        const LocalType& local = v;
-        ProtoType proto = MESSAGE_CONVERTER::encoderInit(local);
+        LazyMessage() = default;
+        LazyMessage(LocalType&& value) : _value(new LocalType(std::move(value))), _hasEncoded(false) {}
 
-        if (!pb_field_iter_begin(&iter, unionContainer, &proto))
-            return false;
-        do
-        {
-            if (iter.submsg_desc == MESSAGE_CONVERTER::getMsgType()){
-                /* This is our field, encode the message using it. */
-                if (!pb_encode_tag_for_field(&stream, &iter))
-                    return false;
-                return pb_encode_submessage(&stream, MESSAGE_CONVERTER::getMsgType(), &proto);
+        /**
+         * Decode message if it wasn't decoded yet.
+         *
+         * @return NULL if encoded message is invalid.
+         */
+        const LocalType* get(){
+            if (!_value) {
+                std::unique_ptr<LocalType> value(new LocalType());
+                if (!decode<MESSAGE_CONVERTER>(_encoded.data(), _encoded.size(), *value))
+                    return nullptr;
+                _value = std::move(value);
             }
-        } while (pb_field_iter_next(&iter));
+            return _value.get();
+        }
 
-        /* Didn't find the field for messagetype */
-        return false;
-    }
+        /**
+         * Same as get(), but drops encoded bytes: message will be encoded from the decoded value.
+         */
+        LocalType* getMutable(){
+            if (!get())
+                return nullptr;
+            _encoded.clear();
+            _hasEncoded = false;
+            return _value.get();
+        }
+
+        void set(LocalType&& value){
+            _value.reset(new LocalType(std::move(value)));
+            _encoded.clear();
+            _hasEncoded = false;
+        }
+
+        bool isDecoded() const { return _value != nullptr; }
 
-    /**
-     * Decode message from stream
-     */
-    template<class MESSAGE_CONVERTER>
-    bool decode(pb_istream_t &stream, typename MESSAGE_CONVERTER::LocalType& v){
-        using ProtoType = typename MESSAGE_CONVERTER::ProtoType;
-        using DecoderContext = typename MESSAGE_CONVERTER::DecoderContext;
+        /**
+         * Encoded message without tag and length, available until message is modified.
+         */
+        bool hasEncoded() const { return _hasEncoded; }
+        const BufferType& getEncoded() const { return _encoded; }
 
-        DecoderContext local = v;
-        ProtoType proto = MESSAGE_CONVERTER::decoderInit(local);
+    public: // for internal use
+        BufferType& _setEncoded(){
+            _value.reset();
+            _hasEncoded = true;
+            return _encoded;
+        }
+        const LocalType& _getValue() const { return *_value; }
 
-        if (!pb_decode(&stream, MESSAGE_CONVERTER::getMsgType(), &proto))
-            return false;
-        if (!MESSAGE_CONVERTER::decoderApply(proto, local))
-            return false;
-        return true;
-    }
+    private:
+        std::unique_ptr<LocalType> _value;
+        BufferType _encoded;
+        bool _hasEncoded = true; // Empty bytes is a default message
+    };
 
     /**
-     * Decode from buffer in memory
+     * Lookup of enum values by integer key: dense array if keys have no big gaps, sorted array otherwise.
+     * Unknown keys are mapped to the default value.
+     *
+     * NOTE: for internal use in EnumTable.
      */
-    template<class MESSAGE_CONVERTER>
-    bool decode(const void* data, const pb_size_t dataSize, typename MESSAGE_CONVERTER::LocalType& v){
-        pb_istream_t stream = pb_istream_from_buffer((pb_byte_t*)data, dataSize);
-        return decode<MESSAGE_CONVERTER>(stream, v);
-    }
+    template<class VALUE>
+    class _EnumLookup {
+    public:
+        using Entry = std::pair<pb_int64_t, VALUE>;
+
+        _EnumLookup(std::vector<Entry> entries, VALUE defaultValue) : _default(defaultValue) {
+            // Keep the first entry of the duplicate key
+            std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){ return a.first < b.first; });
+            entries.erase(std::unique(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){ return a.first == b.first; }),
+                          entries.end());
+            if (entries.empty())
+                return;
+
+            _min = entries.front().first;
+            const pb_uint64_t range = (pb_uint64_t) entries.back().first - (pb_uint64_t) _min + 1;
+            if (range <= entries.size() * 2 + 16) {
+                _dense.resize((size_t) range, defaultValue);
+                for (const auto& entry : entries)
+                    _dense[(size_t) ((pb_uint64_t) entry.first - (pb_uint64_t) _min)] = entry.second;
+            } else {
+                _sorted = std::move(entries);
+            }
+        }
+
+        VALUE find(pb_int64_t key) const {
+            if (!_dense.empty()) {
+                const pb_uint64_t index = (pb_uint64_t) key - (pb_uint64_t) _min;
+                return index < _dense.size() ? _dense[(size_t) index] : _default;
+            }
+            auto it = std::lower_bound(_sorted.begin(), _sorted.end(), key,
+                                       [](const Entry& entry, pb_int64_t key){ return entry.first < key; });
+            return (it != _sorted.end() && it->first == key) ? it->second : _default;
+        }
+
+    private:
+        VALUE _default;
+        pb_int64_t _min = 0;
+        std::vector<VALUE> _dense; // Indexed by (key - _min)
+        std::vector<Entry> _sorted; // Used if keys are sparse
+    };
 
     /**
-     * Decode sub message
+     * EnumTable
+     *
+     * Mapping of local enum values to proto enum values and back, see `Converter::EnumTableConverter`.
+     * First pair is the default for unknown values.
      */
-    template<class MESSAGE_CONVERTER>
-    bool decodeSubMessage(pb_istream_t &stream, typename MESSAGE_CONVERTER::LocalType& v){
-        pb_istream_t subStream;
+    template<class LOCAL_TYPE, class PROTO_TYPE>
+    class EnumTable {
+    public:
+        using Pair = std::pair<LOCAL_TYPE, PROTO_TYPE>;
 
-        if (!pb_make_string_substream(&stream, &subStream))
-            return false;
+        EnumTable(std::initializer_list<Pair> values) :
+                _toProto(_protoEntries(values), values.size() ? values.begin()->second : PROTO_TYPE()),
+                _toLocal(_localEntries(values), values.size() ? values.begin()->first : LOCAL_TYPE())
+        {}
 
-        if (!decode<MESSAGE_CONVERTER>(subStream, v))
-            return false;
+        PROTO_TYPE toProto(LOCAL_TYPE local) const { return _toProto.find(static_cast<pb_int64_t>(local)); }
+        LOCAL_TYPE toLocal(PROTO_TYPE proto) const { return _toLocal.find(static_cast<pb_int64_t>(proto)); }
+        /**
+         * Same as `toLocal()`, but for raw value from the wire, which may be not listed in PROTO_TYPE.
+         */
+        LOCAL_TYPE toLocalValue(pb_int64_t value) const { return _toLocal.find(value); }
 
-        if (!pb_close_string_substream(&stream, &subStream))
-            return false;
-        return true;
-    }
+    private:
+        static std::vector<typename _EnumLookup<PROTO_TYPE>::Entry> _protoEntries(std::initializer_list<Pair> values){
+            std::vector<typename _EnumLookup<PROTO_TYPE>::Entry> ret;
+            for (const auto& pair : values)
+                ret.emplace_back(static_cast<pb_int64_t>(pair.first), pair.second);
+            return ret;
+        }
+
+        static std::vector<typename _EnumLookup<LOCAL_TYPE>::Entry> _localEntries(std::initializer_list<Pair> values){
+            std::vector<typename _EnumLookup<LOCAL_TYPE>::Entry> ret;
+            for (const auto& pair : values)
+                ret.emplace_back(static_cast<pb_int64_t>(pair.second), pair.first);
+            return ret;
+        }
 
-    /**
-     * Decode union message type
-     */
-    const pb_msgdesc_t* decodeUnionMessageType(pb_istream_t &stream, const pb_msgdesc_t* unionContainer);
+    private:
+        _EnumLookup<PROTO_TYPE> _toProto;
+        _EnumLookup<LOCAL_TYPE> _toLocal;
+    };
 
     /**
      * Basic Scalar types.
@@ -174,58 +1471,114 @@ namespace NanoPb {
      *
      */
     namespace Type {
-        template<class LOCAL_TYPE>
+        template<class LOCAL_TYPE, pb_wire_type_t WIRE_TYPE>
         class AbstractScalarType {
         public:
             using LocalType = LOCAL_TYPE;
+            static constexpr pb_wire_type_t getWireType(){ return WIRE_TYPE; }
+            /**
+             * On little-endian hosts local value has same layout as on wire, see `FixedArrayBlock`.
+             */
+            static constexpr bool hasWireLayout(){ return false; }
         };
 
-        class Int32 : public AbstractScalarType<int32_t>{
+        /**
+         * Varint scalar type
+         *
+         *  Should also implement
+         *      fromVarint() - convert raw value, decoded by `decodeVarints()`, to the local value.
+         *      toVarint() - convert local value to raw value for `encodeVarints()`.
+         *
+         * @tparam VARINT_MAX - Max raw value accepted by fromVarint(). Larger values are decoded by nanopb.
+         */
+        template<class LOCAL_TYPE, pb_uint64_t VARINT_MAX>
+        class AbstractVarintType : public AbstractScalarType<LOCAL_TYPE, PB_WT_VARINT> {
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static constexpr pb_uint64_t getVarintMax(){ return VARINT_MAX; }
+        protected:
+            static pb_int64_t zigZagDecode(pb_uint64_t raw){
+                return (raw & 1) ? (pb_int64_t)(~(raw >> 1)) : (pb_int64_t)(raw >> 1);
+            }
+            static pb_uint64_t zigZagEncode(pb_int64_t value){
+                return value < 0 ? ~((pb_uint64_t)value << 1) : (pb_uint64_t)value << 1;
+            }
         };
 
-        class SInt32 : public AbstractScalarType<int32_t>{
+        class Int32 : public AbstractVarintType<int32_t, pb_uint64_t(-1)>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ pb_int64_t v = value; return pb_encode_svarint(stream, v); }
+            static bool decode(pb_istream_t *stream, LocalType& value){
+                pb_int64_t v;
+                if (!pb_decode_svarint(stream, &v))
+                    return false;
+                value = v;
+                return true;
+            }
+            static LocalType fromVarint(pb_uint64_t raw){ return (LocalType)zigZagDecode(raw); }
+            static pb_uint64_t toVarint(const LocalType& value){ return zigZagEncode(value); }
         };
 
-        class UInt32 : public AbstractScalarType<uint32_t>{
+        class SInt32 : public AbstractVarintType<int32_t, pb_uint64_t(-1)>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ pb_int64_t v = value; return pb_encode_svarint(stream, v); }
+            static bool decode(pb_istream_t *stream, LocalType& value){
+                pb_int64_t v;
+                if (!pb_decode_svarint(stream, &v))
+                    return false;
+                value = v;
+                return true;
+            }
+            static LocalType fromVarint(pb_uint64_t raw){ return (LocalType)zigZagDecode(raw); }
+            static pb_uint64_t toVarint(const LocalType& value){ return zigZagEncode(value); }
         };
 
-        class Fixed32 : public AbstractScalarType<uint32_t>{
+        class UInt32 : public AbstractVarintType<uint32_t, UINT32_MAX>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_varint(stream, value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){ return pb_decode_varint32(stream, &value); }
+            static LocalType fromVarint(pb_uint64_t raw){ return (LocalType)raw; }
+            static pb_uint64_t toVarint(const LocalType& value){ return value; }
         };
 
-        class SFixed32 : public AbstractScalarType<int32_t>{
+        class Fixed32 : public AbstractScalarType<uint32_t, PB_WT_32BIT>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static constexpr bool hasWireLayout(){ return true; }
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_fixed32(stream, &value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){ return pb_decode_fixed32(stream, &value); }
         };
 
-        class Float : public AbstractScalarType<float>{
+        class SFixed32 : public AbstractScalarType<int32_t, PB_WT_32BIT>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static constexpr bool hasWireLayout(){ return true; }
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_fixed32(stream, &value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){ return pb_decode_fixed32(stream, &value); }
         };
 
-        class Bool : public AbstractScalarType<bool>{
+        class Float : public AbstractScalarType<float, PB_WT_32BIT>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static constexpr bool hasWireLayout(){ return true; }
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_fixed32(stream, &value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){ return pb_decode_fixed32(stream, &value); }
+        };
+
+        class Bool : public AbstractVarintType<bool, UINT32_MAX>{
+        public:
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ uint32_t v = value; return pb_encode_varint(stream, v); }
+            static bool decode(pb_istream_t *stream, LocalType& value){
+                uint32_t v;
+                if (!pb_decode_varint32(stream, &v))
+                    return false;
+                value = v;
+                return true;
+            }
+            static LocalType fromVarint(pb_uint64_t raw){ return raw != 0; }
+            static pb_uint64_t toVarint(const LocalType& value){ return value ? 1 : 0; }
         };
 
         /**
          * NOTE: encode()/decode() **does NOT** add length for String/Bytes
          */
-        class String : public AbstractScalarType<std::string>{
+        class String : public AbstractScalarType<std::string, PB_WT_STRING>{
         public:
             static bool encode(pb_ostream_t *stream, const LocalType& value);
             static bool decode(pb_istream_t *stream, LocalType& value);
@@ -234,52 +1587,93 @@ namespace NanoPb {
         /**
          * NOTE: encode()/decode() **does NOT** add length for String/Bytes
          */
-        class Bytes : public AbstractScalarType<std::string>{ // use std::string as container
+        class Bytes : public AbstractScalarType<std::string, PB_WT_STRING>{ // use std::string as container
         public:
             static bool encode(pb_ostream_t *stream, const LocalType& value);
             static bool decode(pb_istream_t *stream, LocalType& value);
         };
 
 #ifndef PB_WITHOUT_64BIT
-        class Int64 : public AbstractScalarType<int64_t>{
+        class Int64 : public AbstractVarintType<int64_t, UINT64_MAX>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_svarint(stream, value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){
+                pb_int64_t v;
+                if (!pb_decode_svarint(stream, &v))
+                    return false;
+                value = v;
+                return true;
+            }
+            static LocalType fromVarint(pb_uint64_t raw){ return zigZagDecode(raw); }
+            static pb_uint64_t toVarint(const LocalType& value){ return zigZagEncode(value); }
         };
 
-        class SInt64 : public AbstractScalarType<int64_t>{
+        class SInt64 : public AbstractVarintType<int64_t, UINT64_MAX>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ pb_int64_t v = value; return pb_encode_svarint(stream, v); }
+            static bool decode(pb_istream_t *stream, LocalType& value){
+                pb_int64_t v;
+                if (!pb_decode_svarint(stream, &v))
+                    return false;
+                value = v;
+                return true;
+            }
+            static LocalType fromVarint(pb_uint64_t raw){ return zigZagDecode(raw); }
+            static pb_uint64_t toVarint(const LocalType& value){ return zigZagEncode(value); }
         };
 
-        class UInt64 : public AbstractScalarType<uint64_t>{
+        class UInt64 : public AbstractVarintType<uint64_t, UINT64_MAX>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_varint(stream, value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){
+                pb_uint64_t v;
+                if (!pb_decode_varint(stream, &v))
+                    return false;
+                value = v;
+                return true;
+            }
+            static LocalType fromVarint(pb_uint64_t raw){ return raw; }
+            static pb_uint64_t toVarint(const LocalType& value){ return value; }
         };
 
-        class Fixed64 : public AbstractScalarType<uint64_t>{
+        class Fixed64 : public AbstractScalarType<uint64_t, PB_WT_64BIT>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static constexpr bool hasWireLayout(){ return true; }
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_fixed64(stream, &value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){ return pb_decode_fixed64(stream, &value); }
         };
 
-        class SFixed64 : public AbstractScalarType<int64_t>{
+        class SFixed64 : public AbstractScalarType<int64_t, PB_WT_64BIT>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static constexpr bool hasWireLayout(){ return true; }
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_fixed64(stream, &value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){ return pb_decode_fixed64(stream, &value); }
         };
 
-        class Double : public AbstractScalarType<double>{
+        class Double : public AbstractScalarType<double, PB_WT_64BIT>{
         public:
-            static bool encode(pb_ostream_t *stream, const LocalType& value);
-            static bool decode(pb_istream_t *stream, LocalType& value);
+            static constexpr bool hasWireLayout(){ return true; }
+            static bool encode(pb_ostream_t *stream, const LocalType& value){ return pb_encode_fixed64(stream, &value); }
+            static bool decode(pb_istream_t *stream, LocalType& value){ return pb_decode_fixed64(stream, &value); }
         };
 #endif
     }
 
     namespace Converter {
+        /**
+         * Item converters, which `ArrayConverter` encodes as field tag, computed once per field, followed by
+         * `encodeValue()` of the item. Items of other converters are encoded by own `encodeCallback()`.
+         *
+         *  Built-in converters opt in. Specialize it for custom converter, which `encodeCallback()` writes
+         *  field tag followed by `encodeValue()`, for example for message converter:
+         *
+         *      namespace NanoPb { namespace Converter {
+         *          template<> struct EncodeItemValue<TestMessageConverter> : std::true_type {};
+         *      }}
+         */
+        template<class CONVERTER>
+        struct EncodeItemValue : std::false_type {};
+
         /**
           * Callback converter
           *
@@ -298,10 +1692,55 @@ namespace NanoPb {
         public:
             using LocalType = LOCAL_TYPE;
         public:
+            /**
+             * Wire type of the value. Callback converters are length-delimited by default.
+             */
+            static constexpr pb_wire_type_t getWireType(){ return PB_WT_STRING; }
+
             static pb_callback_t encoderCallbackInit(const LocalType& local) { return pb_callback_t{ .funcs = { .encode = _pbEncodeCallback }, .arg = (void*)&local }; }
-            static pb_callback_t decoderCallbackInit(LocalType& local) { return pb_callback_t{ .funcs = { .decode = _pbDecodeCallback }, .arg = (void*)&local }; }
+            static pb_callback_t decoderCallbackInit(LocalType& local) {
+#if NANOPB_CPP_DECODE_REUSE
+                if (DecodeReuseContext::isAnyActive()) {
+                    DecodeReuseContext* context = DecodeReuseContext::getActive();
+                    if (context)
+                        return pb_callback_t{ .funcs = { .decode = _pbDecodeReuseCallback }, .arg = (void*)(uintptr_t)context->addField(&local, &_decodeReuseFinish) };
+                }
+#endif
+                return pb_callback_t{ .funcs = { .decode = _pbDecodeCallback }, .arg = (void*)&local };
+            }
+
+            /**
+             * Decode callback for `decodeReuse()`: local contains the previous value.
+             *
+             * @param count - number of the previous calls for this field in the current message
+             */
+            static bool decodeReuseCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local, size_t &count){
+                count++;
+                return DERIVED::decodeCallback(stream, field, local);
+            }
+
+            /**
+             * Called by `decodeReuse()` when all fields of the message are decoded.
+             * Should reset or trim the previous value, if it wasn't overwritten.
+             */
+            static void decodeReuseFinish(LocalType &local, size_t count){}
 
         private:
+            static bool _pbDecodeReuseCallback(pb_istream_t *stream, const pb_field_t *field, void **arg){
+                DecodeReuseContext* context = DecodeReuseContext::getActive();
+                NANOPB_CPP_ASSERT(context);
+                const size_t index = (size_t)(uintptr_t)*arg;
+                // Nested messages add fields to the context, so don't keep references into it
+                size_t count = context->getFieldCount(index);
+                if (!DERIVED::decodeReuseCallback(stream, field, *static_cast<LocalType *>(context->getFieldLocal(index)), count))
+                    return false;
+                context->setFieldCount(index, count);
+                return true;
+            }
+            static void _decodeReuseFinish(void* local, size_t count){
+                DERIVED::decodeReuseFinish(*static_cast<LocalType *>(local), count);
+            }
+
             static bool _pbEncodeCallback(pb_ostream_t *stream, const pb_field_t *field, void *const *arg){
                 return DERIVED::encodeCallback(stream, field, *(static_cast<const LocalType *>(*arg)));
             };
@@ -336,9 +1775,18 @@ namespace NanoPb {
             using ProtoType = PROTO_TYPE;
 
         public:
+            static constexpr pb_wire_type_t getWireType(){ return Type::Int32::getWireType(); }
+
             static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local){
-                if (!pb_encode_tag_for_field(stream, field))
+                if (!FieldTag(field->tag, getWireType()).write(stream))
                     return false;
+                return encodeValue(stream, local);
+            }
+
+            /**
+             * Encode value without tag
+             */
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local){
                 ProtoType v = DERIVED::encode(local);
                 return Type::Int32::encode(stream, v);
             }
@@ -347,9 +1795,16 @@ namespace NanoPb {
                 int32_t v;
                 if (!Type::Int32::decode(stream, v))
                     return false;
-                local = DERIVED::decode(static_cast<ProtoType>(v));
+                local = DERIVED::decodeValue(v);
                 return true;
             }
+
+            /**
+             * Decode raw value from the wire, which may be not listed in ProtoType.
+             */
+            static LocalType decodeValue(int32_t value){
+                return DERIVED::decode(static_cast<ProtoType>(value));
+            }
         public:
             static ProtoType encoderInit(const LocalType& local){
                 return DERIVED::encode(local);
@@ -363,6 +1818,42 @@ namespace NanoPb {
             template<class T> static void _mapEncoderApply(T& pair){}
         };
 
+        /**
+         * Table driven enum converter
+         *
+         *  Derived class must implement next method:
+         *
+         *      static const NanoPb::EnumTable<LocalType, ProtoType>& getTable(){
+         *          static const NanoPb::EnumTable<LocalType, ProtoType> table({
+         *              {Food::Invalid, PROTO_Food_Invalid},
+         *              {Food::Meat, PROTO_Food_Meat}
+         *          });
+         *          return table;
+         *      }
+         *
+         *  Repeated enum fields are decoded/encoded in varint blocks by `ArrayConverter`/`PackedArrayConverter`.
+         *
+         * @tparam DERIVED - Derived class
+         * @tparam LOCAL_TYPE - Local type
+         * @tparam PROTO_TYPE - NanoPb type
+         */
+        template<class DERIVED, class LOCAL_TYPE, class PROTO_TYPE>
+        class EnumTableConverter : public EnumConverter<DERIVED, LOCAL_TYPE, PROTO_TYPE> {
+        public:
+            using LocalType = LOCAL_TYPE;
+            using ProtoType = PROTO_TYPE;
+
+            static ProtoType encode(const LocalType& local){ return DERIVED::getTable().toProto(local); }
+            static LocalType decode(const ProtoType& proto){ return DERIVED::getTable().toLocal(proto); }
+            static LocalType decodeValue(int32_t value){ return DERIVED::getTable().toLocalValue(value); }
+
+            class ScalarType : public Type::AbstractVarintType<LocalType, pb_uint64_t(-1)> {
+            public:
+                static LocalType fromVarint(pb_uint64_t raw){ return decodeValue(Type::Int32::fromVarint(raw)); }
+                static pb_uint64_t toVarint(const LocalType& value){ return Type::Int32::toVarint(static_cast<int32_t>(encode(value))); }
+            };
+        };
+
 
         /**
          * Message converter
@@ -396,10 +1887,23 @@ namespace NanoPb {
         public:
             static constexpr const pb_msgdesc_t *getMsgType(){ return PROTO_TYPE_MSG; }
 
+            /**
+             * Override and return true, if message has `Reserve::CountTags` array fields:
+             * memory of the message is recorded while it is decoded, see `DecodedMessage`.
+             */
+            static constexpr bool countsFieldTags(){ return false; }
+
         public:
             static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local){
-                if (!pb_encode_tag_for_field(stream, field))
+                if (!FieldTag(field->tag, PB_WT_STRING).write(stream))
                     return false;
+                return encodeValue(stream, local);
+            }
+
+            /**
+             * Encode message with size prefix, without tag
+             */
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local){
                 return encodeSubMessage<DERIVED>(*stream, local);
             }
 
@@ -407,9 +1911,30 @@ namespace NanoPb {
                 return decode<DERIVED>(*stream, local);
             }
 
+            static bool decodeReuseCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local, size_t &count){
+                count++;
+                return _decodeReuse<DERIVED>(*stream, local, *DecodeReuseContext::getActive());
+            }
+
+            /**
+             * Reset the previous value, if message has no such field.
+             */
+            static void decodeReuseFinish(LocalType &local, size_t count){
+                if (count == 0)
+                    _reset(local, std::is_move_assignable<LocalType>());
+            }
+
         public: // for internal use
             template<class T>
             static void _mapEncoderApply(T& pair){ pair.has_value = true; }
+
+        private:
+            static void _reset(LocalType &local, std::true_type){ local = LocalType(); }
+            // Local type is required to be default and move constructible only
+            static void _reset(LocalType &local, std::false_type){
+                local.~LocalType();
+                new (&local) LocalType();
+            }
         };
 
         /**
@@ -433,11 +1958,144 @@ namespace NanoPb {
             using LocalType = LOCAL_TYPE;
             using ProtoType = PROTO_TYPE;
 
-            static pb_callback_t unionDecoderInit(LocalType& local) { return pb_callback_t{ .funcs = { .decode = _unionDecodeCallback }, .arg = (void*)&local }; }
+            static pb_callback_t unionDecoderInit(LocalType& local) { return pb_callback_t{ .funcs = { .decode = _unionDecodeCallback }, .arg = (void*)&local }; }
+
+        private:
+            static bool _unionDecodeCallback(pb_istream_t *stream, const pb_field_t *field, void **arg){
+#if NANOPB_CPP_DECODE_REUSE
+                if (DecodeReuseContext::isAnyActive()) {
+                    // Union message object is created here, so there is nothing to reuse
+                    DecodeReuseContext::Scope noReuse(NULL);
+                    return DERIVED::unionDecodeCallback(stream, field, *(static_cast<LocalType *>(*arg)));
+                }
+#endif
+                return DERIVED::unionDecodeCallback(stream, field, *(static_cast<LocalType *>(*arg)));
+            }
+        };
+
+        /**
+         * Union variant case: tag of the union field and converter of its sub message.
+         *
+         * @tparam TAG - Tag of the union field, e.g. `PROTO_UnionContainer_msg1_tag`
+         * @tparam CONVERTER - Converter of the sub message
+         */
+        template<pb_size_t TAG, class CONVERTER>
+        struct UnionVariantCase {
+            using Converter = CONVERTER;
+            static constexpr pb_size_t tag = TAG;
+        };
+
+        /**
+         * Converter for union (oneof) field, stored in variant type without heap allocation:
+         * `NanoPb::InlineVariant` or `std::variant` (C++17), see `NanoPb::VariantTraits`.
+         * Variant types and CASES converters should have same order, leading `std::monostate` of `std::variant` has no case.
+         *
+         * Methods are called from the `UnionMessageConverter` of the union container:
+         *
+         *      encoderInit():          proto.which_msg = VariantConverter::encoderInit(local.message, &proto.msg);
+         *      unionDecodeCallback():  return VariantConverter::unionDecodeCallback(stream, field, local.message);
+         *      decoderApply():         return VariantConverter::decoderApply(proto.which_msg, &proto.msg, local.message);
+         *
+         * @tparam VARIANT - Variant type
+         * @tparam CASES - List of `UnionVariantCase`
+         */
+        template<class VARIANT, class... CASES>
+        class UnionVariantConverter {
+        public:
+            using LocalType = VARIANT;
+            using Traits = VariantTraits<VARIANT>;
+
+            static_assert(std::is_same<typename Traits::Types, std::tuple<typename CASES::Converter::LocalType...>>::value,
+                          "Variant types should match local types of case converters");
+
+            /**
+             * Init union member of the proto with the stored sub message.
+             *
+             * @param unionData - union of the proto
+             * @return tag of the stored sub message for `which_xxx` field or 0 if variant is empty.
+             */
+            static pb_size_t encoderInit(const LocalType& local, void* unionData){
+                static const EncoderInitFunc table[] = { &_encoderInit<CASES>... };
+                const int index = Traits::index(local);
+                return index < 0 ? 0 : table[index](local, unionData);
+            }
+
+            /**
+             * Create sub message in the variant and init its proto.
+             */
+            static bool unionDecodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType& local){
+                const Entry* entry = _findEntry(field->tag);
+                if (!entry)
+                    return false;
+                entry->decoderInit(local, field->pData);
+                return true;
+            }
+
+            /**
+             * Apply decoded proto of the sub message.
+             *
+             * @param which - `which_xxx` field of the proto
+             * @param unionData - union of the proto
+             */
+            static bool decoderApply(pb_size_t which, const void* unionData, LocalType& local){
+                if (which == 0) {
+                    Traits::reset(local);
+                    return true;
+                }
+                const Entry* entry = _findEntry(which);
+                if (!entry || (entry - _getEntries()) != Traits::index(local))
+                    return false;
+                return entry->decoderApply(unionData, local);
+            }
 
         private:
-            static bool _unionDecodeCallback(pb_istream_t *stream, const pb_field_t *field, void **arg){
-                return DERIVED::unionDecodeCallback(stream, field, *(static_cast<LocalType *>(*arg)));
+            using EncoderInitFunc = pb_size_t (*)(const LocalType&, void*);
+
+            struct Entry {
+                pb_size_t tag;
+                void (*decoderInit)(LocalType&, void*);
+                bool (*decoderApply)(const void*, LocalType&);
+            };
+
+            static const Entry* _getEntries(){
+                static const Entry entries[] = { { CASES::tag, &_decoderInit<CASES>, &_decoderApply<CASES> }... };
+                return entries;
+            }
+
+            static const Entry* _findEntry(pb_size_t tag){
+                const Entry* entries = _getEntries();
+                const size_t count = sizeof...(CASES);
+                // Tags of union fields are usually consecutive
+                const size_t index = tag - entries[0].tag;
+                if (tag >= entries[0].tag && index < count && entries[index].tag == tag)
+                    return &entries[index];
+                for (size_t i = 0; i < count; i++) {
+                    if (entries[i].tag == tag)
+                        return &entries[i];
+                }
+                return nullptr;
+            }
+
+            template<class CASE>
+            static pb_size_t _encoderInit(const LocalType& local, void* unionData){
+                using Converter = typename CASE::Converter;
+                using CaseLocal = typename Converter::LocalType;
+                *static_cast<typename Converter::ProtoType*>(unionData) = Converter::encoderInit(Traits::template get<CaseLocal>(local));
+                return CASE::tag;
+            }
+
+            template<class CASE>
+            static void _decoderInit(LocalType& local, void* unionData){
+                using Converter = typename CASE::Converter;
+                using CaseLocal = typename Converter::LocalType;
+                *static_cast<typename Converter::ProtoType*>(unionData) = Converter::decoderInit(Traits::template emplace<CaseLocal>(local));
+            }
+
+            template<class CASE>
+            static bool _decoderApply(const void* unionData, LocalType& local){
+                using Converter = typename CASE::Converter;
+                using CaseLocal = typename Converter::LocalType;
+                return Converter::decoderApply(*static_cast<const typename Converter::ProtoType*>(unionData), Traits::template get<CaseLocal>(local));
             }
         };
 
@@ -454,10 +2112,20 @@ namespace NanoPb {
         public:
             using LocalType = typename SCALAR::LocalType;
             using ProtoType = typename SCALAR::LocalType; // Proto type for basic scalar is same as local.
+            using ScalarType = SCALAR;
         public:
+            static constexpr pb_wire_type_t getWireType(){ return SCALAR::getWireType(); }
+
             static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local){
-                if (!pb_encode_tag_for_field(stream, field))
+                if (!FieldTag(field->tag, getWireType()).write(stream))
                     return false;
+                return encodeValue(stream, local);
+            }
+
+            /**
+             * Encode value without tag
+             */
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local){
                 return SCALAR::encode(stream, local);
             }
             static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local){
@@ -490,54 +2158,494 @@ namespace NanoPb {
         class SFixed64Converter : public AbstractScalarConverter<SFixed64Converter,Type::SFixed64> {};
         class DoubleConverter : public AbstractScalarConverter<DoubleConverter,Type::Double> {};
 #endif
+
+        template<> struct EncodeItemValue<Int32Converter> : std::true_type {};
+        template<> struct EncodeItemValue<SInt32Converter> : std::true_type {};
+        template<> struct EncodeItemValue<UInt32Converter> : std::true_type {};
+        template<> struct EncodeItemValue<Fixed32Converter> : std::true_type {};
+        template<> struct EncodeItemValue<SFixed32Converter> : std::true_type {};
+        template<> struct EncodeItemValue<FloatConverter> : std::true_type {};
+        template<> struct EncodeItemValue<BoolConverter> : std::true_type {};
+#ifndef PB_WITHOUT_64BIT
+        template<> struct EncodeItemValue<Int64Converter> : std::true_type {};
+        template<> struct EncodeItemValue<SInt64Converter> : std::true_type {};
+        template<> struct EncodeItemValue<UInt64Converter> : std::true_type {};
+        template<> struct EncodeItemValue<Fixed64Converter> : std::true_type {};
+        template<> struct EncodeItemValue<SFixed64Converter> : std::true_type {};
+        template<> struct EncodeItemValue<DoubleConverter> : std::true_type {};
+#endif
+
         class StringConverter : public CallbackConverter<StringConverter, std::string> {
         public:
             static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local);
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local);
             static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local);
         public:
             static pb_callback_t encoderInit(const LocalType& local){ return encoderCallbackInit(local);}
             static pb_callback_t decoderInit(LocalType& local){ return decoderCallbackInit(local);}
             static bool decoderApply(const pb_callback_t& proto, LocalType& local){ return true;/* nothing to apply */}
+        public:
+            static void decodeReuseFinish(LocalType &local, size_t count){
+                if (count == 0)
+                    local.clear();
+            }
         };
 
         class BytesConverter : public CallbackConverter<BytesConverter, std::string> {
         public:
             static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local);
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local);
+            static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local);
+        public:
+            static pb_callback_t encoderInit(const LocalType& local){ return encoderCallbackInit(local);}
+            static pb_callback_t decoderInit(LocalType& local){ return decoderCallbackInit(local);}
+            static bool decoderApply(const pb_callback_t& proto, LocalType& local){ return true;/* nothing to apply */}
+        public:
+            static void decodeReuseFinish(LocalType &local, size_t count){
+                if (count == 0)
+                    local.clear();
+            }
+        };
+
+        /**
+         * String view converter: decoded value points into the input buffer, nothing is copied.
+         * Works only with memory input streams (see `MemoryInputStream::getCurrentPosition()`), other streams fail to decode.
+         *
+         * NOTE: Input buffer should be alive while decoded views are in use.
+         */
+        class StringViewConverter : public CallbackConverter<StringViewConverter, StringView> {
+        public:
+            static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local);
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local);
+            static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local);
+        public:
+            static pb_callback_t encoderInit(const LocalType& local){ return encoderCallbackInit(local);}
+            static pb_callback_t decoderInit(LocalType& local){ return decoderCallbackInit(local);}
+            static bool decoderApply(const pb_callback_t& proto, LocalType& local){ return true;/* nothing to apply */}
+        public:
+            static void decodeReuseFinish(LocalType &local, size_t count){
+                if (count == 0)
+                    local = LocalType();
+            }
+        };
+
+        /**
+         * Same as StringViewConverter, but for `bytes` fields.
+         */
+        class BytesViewConverter : public CallbackConverter<BytesViewConverter, StringView> {
+        public:
+            static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local);
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local);
+            static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local);
+        public:
+            static pb_callback_t encoderInit(const LocalType& local){ return encoderCallbackInit(local);}
+            static pb_callback_t decoderInit(LocalType& local){ return decoderCallbackInit(local);}
+            static bool decoderApply(const pb_callback_t& proto, LocalType& local){ return true;/* nothing to apply */}
+        public:
+            static void decodeReuseFinish(LocalType &local, size_t count){
+                if (count == 0)
+                    local = LocalType();
+            }
+        };
+
+        /**
+         * Shared bytes converter: decoded value is a slice of the `SharedInputStream` buffer, nothing is copied.
+         * When message is decoded from other stream, value is copied into its own buffer.
+         */
+        class SharedBytesConverter : public CallbackConverter<SharedBytesConverter, SharedBytes> {
+        public:
+            static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local);
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local);
             static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local);
         public:
             static pb_callback_t encoderInit(const LocalType& local){ return encoderCallbackInit(local);}
             static pb_callback_t decoderInit(LocalType& local){ return decoderCallbackInit(local);}
             static bool decoderApply(const pb_callback_t& proto, LocalType& local){ return true;/* nothing to apply */}
+        public:
+            static void decodeReuseFinish(LocalType &local, size_t count){
+                if (count == 0)
+                    local = LocalType();
+            }
+        };
+
+        template<> struct EncodeItemValue<StringConverter> : std::true_type {};
+        template<> struct EncodeItemValue<BytesConverter> : std::true_type {};
+        template<> struct EncodeItemValue<StringViewConverter> : std::true_type {};
+        template<> struct EncodeItemValue<BytesViewConverter> : std::true_type {};
+        template<> struct EncodeItemValue<SharedBytesConverter> : std::true_type {};
+
+        /**
+         * Containers which store items in one contiguous block of memory.
+         *
+         *  Specialize it for custom container with `data()`, `size()` and `resize()` to enable raw block access.
+         */
+        template<class CONTAINER>
+        struct IsContiguousContainer : std::false_type {};
+
+        template<class T, class ALLOCATOR>
+        struct IsContiguousContainer<std::vector<T, ALLOCATOR>> : std::true_type {};
+
+        /**
+         * True for converters of built-in fixed32/sfixed32/float/fixed64/sfixed64/double scalar types,
+         * see `Type::AbstractScalarType::hasWireLayout()`.
+         */
+        template<class ITEM_CONVERTER, class = void>
+        struct _HasWireLayout : std::false_type {};
+
+        template<class ITEM_CONVERTER>
+        struct _HasWireLayout<ITEM_CONVERTER, typename std::enable_if<ITEM_CONVERTER::ScalarType::hasWireLayout()>::type> :
+                std::true_type {};
+
+        /**
+         * Raw block access for packed fixed-width items
+         *
+         *  On little-endian hosts packed fixed32/sfixed32/float/fixed64/sfixed64/double items have same layout
+         *  on wire and in contiguous container, so whole block is written/read with single pb_write()/pb_read().
+         *  Custom converters are not affected, even with same wire type and local type.
+         *
+         *  NOTE: for internal use in ArrayConverter/PackedArrayConverter.
+         */
+        template<class ITEM_CONVERTER, class CONTAINER, bool ENABLED =
+#if defined(PB_LITTLE_ENDIAN_8BIT) && PB_LITTLE_ENDIAN_8BIT
+                IsContiguousContainer<CONTAINER>::value &&
+                _HasWireLayout<ITEM_CONVERTER>::value &&
+                sizeof(typename CONTAINER::value_type) == (
+                        ITEM_CONVERTER::getWireType() == PB_WT_32BIT ? 4 :
+                        ITEM_CONVERTER::getWireType() == PB_WT_64BIT ? 8 : 0)
+#else
+                false
+#endif
+        >
+        class FixedArrayBlock {
+        public:
+            static constexpr bool isEnabled(){ return false; }
+            static bool write(pb_ostream_t *stream, const CONTAINER &container){ return false; }
+            static bool read(pb_istream_t *stream, CONTAINER &container){ return false; }
+        };
+
+        template<class ITEM_CONVERTER, class CONTAINER>
+        class FixedArrayBlock<ITEM_CONVERTER, CONTAINER, true> {
+            static constexpr size_t _itemSize = sizeof(typename CONTAINER::value_type);
+            static constexpr size_t _chunkSize = 256; // Multiple of any item size
+        public:
+            static constexpr bool isEnabled(){ return true; }
+
+            static bool write(pb_ostream_t *stream, const CONTAINER &container){
+                return pb_write(stream, reinterpret_cast<const pb_byte_t*>(container.data()), container.size() * _itemSize);
+            }
+
+            /**
+             * Append all items left in stream to container.
+             * Length of non-memory stream comes from the wire only, so its items are appended in chunks,
+             * container doesn't grow beyond the data, which was actually read.
+             */
+            static bool read(pb_istream_t *stream, CONTAINER &container){
+                if (stream->bytes_left % _itemSize != 0)
+                    PB_RETURN_ERROR(stream, "invalid packed array size");
+
+                const size_t offset = container.size();
+                size_t chunkSize = _chunkSize;
+                if (MemoryInputStream::getCurrentPosition(stream))
+                    chunkSize = stream->bytes_left;
+                while (stream->bytes_left > 0) {
+                    const size_t size = stream->bytes_left < chunkSize ? stream->bytes_left : chunkSize;
+                    const size_t position = container.size();
+                    container.resize(position + size / _itemSize);
+                    if (!pb_read(stream, reinterpret_cast<pb_byte_t*>(container.data() + position), size)) {
+                        container.resize(offset);
+                        return false;
+                    }
+                }
+                return true;
+            }
         };
 
+        /**
+         * Reserve hints for ArrayConverter
+         *
+         *  Any other value is reserved as is before first item, for example `max_count` from .options file.
+         */
+        namespace Reserve {
+            /**
+             * Don't reserve
+             */
+            constexpr size_t None = 0;
+            /**
+             * Count item tags in the message before first item, see `DecodedMessage::countField()`.
+             * Used for length-delimited items (messages, strings, bytes) only.
+             */
+            constexpr size_t CountTags = size_t(-1);
+        }
+
         /**
          * Array converter for items
          *
          * @tparam ITEM_CONVERTER - Derived from MessageConverter class
          * @tparam CONTAINER can be std::vector<ITEM_CONVERTER::LocalType> or std::ITEM_CONVERTER::LocalType>
+         * @tparam RESERVE - Reserve hint for containers with reserve(), see `Reserve`.
          *
          * NOTE: ITEM_CONVERTER::LocalType and CONTAINER::value_type should match each other
          */
-        template<class ITEM_CONVERTER, class CONTAINER>
-        class ArrayConverter : public CallbackConverter<ArrayConverter<ITEM_CONVERTER, CONTAINER>,CONTAINER>
+        template<class ITEM_CONVERTER, class CONTAINER, size_t RESERVE = Reserve::None>
+        class ArrayConverter : public CallbackConverter<ArrayConverter<ITEM_CONVERTER, CONTAINER, RESERVE>,CONTAINER>
         {
             static_assert(std::is_same<typename ITEM_CONVERTER::LocalType, typename CONTAINER::value_type>::value,
                     "ITEM_CONVERTER::LocalType and CONTAINER::value_type should be same type");
         public:
             static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const CONTAINER &container){
+                return _encodeItems(stream, field, container, EncodeItemValue<ITEM_CONVERTER>());
+            }
+            static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container){
+                if (RESERVE != Reserve::None && container.empty())
+                    _reserveHint(container, field, 0);
+
+                if (ITEM_CONVERTER::getWireType() == PB_WT_STRING)
+                    return _decodeItem(stream, field, container);
+
+                // Scalar items: stream contains one item or all items of the packed field.
+                if (FixedArrayBlock<ITEM_CONVERTER, CONTAINER>::isEnabled())
+                    return FixedArrayBlock<ITEM_CONVERTER, CONTAINER>::read(stream, container);
+
+                return _decodeScalarItems(stream, field, container, 0);
+            }
+
+            static bool decodeReuseCallback(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container, size_t &count){
+                // Scalar items have no memory to reuse, container keeps its capacity.
+                if (ITEM_CONVERTER::getWireType() != PB_WT_STRING || !_isRandomAccess()) {
+                    if (count == 0)
+                        container.clear();
+                    if (!decodeCallback(stream, field, container))
+                        return false;
+                    count = container.size();
+                    return true;
+                }
+
+                // Overwrite existing items, new items are decoded with context too
+                if (count == container.size()) {
+                    if (RESERVE != Reserve::None && container.empty())
+                        _reserveHint(container, field, 0);
+                    container.emplace_back();
+                }
+                size_t itemCount = 0;
+                return ITEM_CONVERTER::decodeReuseCallback(stream, field, *std::next(container.begin(), count++), itemCount);
+            }
+
+            static void decodeReuseFinish(CONTAINER &container, size_t count){
+                // Items may be not assignable, so don't erase range of vector
+                while (container.size() > count)
+                    container.pop_back();
+            }
+        private:
+            static constexpr bool _isRandomAccess(){
+                return std::is_base_of<std::random_access_iterator_tag,
+                        typename std::iterator_traits<typename CONTAINER::iterator>::iterator_category>::value;
+            }
+
+            /**
+             * Items share tag computed once per field, see `EncodeItemValue`
+             */
+            static bool _encodeItems(pb_ostream_t *stream, const pb_field_t *field, const CONTAINER &container, std::true_type){
+                const FieldTag tag(field->tag, ITEM_CONVERTER::getWireType());
+                for (const auto &item: container) {
+                    if (!tag.write(stream))
+                        return false;
+                    if (!ITEM_CONVERTER::encodeValue(stream, item))
+                        return false;
+                }
+                return true;
+            }
+
+            static bool _encodeItems(pb_ostream_t *stream, const pb_field_t *field, const CONTAINER &container, std::false_type){
                 for (const auto &item: container) {
                     if (!ITEM_CONVERTER::encodeCallback(stream, field, item))
                         return false;
                 }
                 return true;
             }
-            static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container){
-                container.emplace_back(typename ITEM_CONVERTER::LocalType());
-                typename ITEM_CONVERTER::LocalType& item = *container.rbegin();
+
+            /**
+             * Varint items from memory stream are decoded in blocks, see `decodeVarints()`
+             */
+            template<class T = ITEM_CONVERTER>
+            static auto _decodeScalarItems(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container, int)
+                    -> decltype(T::ScalarType::fromVarint(pb_uint64_t()), bool()) {
+                using ScalarType = typename T::ScalarType;
+                pb_uint64_t values[32];
+
+                while (stream->bytes_left > 0) {
+                    const pb_byte_t* data = MemoryInputStream::getCurrentPosition(stream);
+                    if (!data)
+                        return _decodeScalarItems(stream, field, container, 0L);
+
+                    size_t count = sizeof(values) / sizeof(values[0]);
+                    const size_t size = decodeVarints(data, stream->bytes_left, ScalarType::getVarintMax(), values, count);
+                    if (count == 0) {
+                        // Let nanopb decode or reject next item
+                        if (!_decodeItem(stream, field, container))
+                            return false;
+                        continue;
+                    }
+                    for (size_t i = 0; i < count; i++)
+                        container.push_back(ScalarType::fromVarint(values[i]));
+                    if (!pb_read(stream, NULL, size))
+                        return false;
+                }
+                return true;
+            }
+
+            static bool _decodeScalarItems(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container, long){
+                // Length of non-memory stream comes from the wire only, it's not trusted for allocation
+                size_t itemSize = _getFixedItemSize();
+                if (itemSize > 0 && stream->bytes_left > itemSize && MemoryInputStream::getCurrentPosition(stream))
+                    _reserve(container, container.size() + stream->bytes_left / itemSize, 0);
+
+                while (stream->bytes_left > 0) {
+                    if (!_decodeItem(stream, field, container))
+                        return false;
+                }
+                return true;
+            }
+
+            static bool _decodeItem(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container){
+                container.emplace_back();
+                typename ITEM_CONVERTER::LocalType& item = container.back();
                 if (!ITEM_CONVERTER::decodeCallback(stream, field, item))
                     return false;
                 return true;
             }
+
+            static constexpr size_t _getFixedItemSize(){
+                return ITEM_CONVERTER::getWireType() == PB_WT_32BIT ? 4 :
+                       ITEM_CONVERTER::getWireType() == PB_WT_64BIT ? 8 : 0;
+            }
+
+            template<class T>
+            static auto _reserve(T& container, size_t size, int) -> decltype(container.reserve(size), void()) {
+                container.reserve(size);
+            }
+            template<class T>
+            static void _reserve(T& container, size_t size, long) {}
+
+            template<class T>
+            static auto _reserveHint(T& container, const pb_field_t *field, int) -> decltype(container.reserve(0), void()) {
+                if (RESERVE != Reserve::CountTags) {
+                    container.reserve(RESERVE);
+                    return;
+                }
+                size_t count;
+                if (ITEM_CONVERTER::getWireType() == PB_WT_STRING && DecodedMessage::countField(field, PB_WT_STRING, count))
+                    container.reserve(count);
+            }
+            template<class T>
+            static void _reserveHint(T& container, const pb_field_t *field, long) {}
+        };
+
+        /**
+         * Packed array converter for scalar items
+         *
+         *  Encodes all items as single length-delimited block (proto3 packed encoding).
+         *  Decodes both packed and not packed fields.
+         *
+         * @tparam ITEM_CONVERTER - Scalar converter with PB_WT_VARINT, PB_WT_64BIT or PB_WT_32BIT wire type,
+         *                          like Int32Converter, FloatConverter or EnumConverter.
+         * @tparam CONTAINER can be std::vector<ITEM_CONVERTER::LocalType> or std::list<ITEM_CONVERTER::LocalType>
+         * @tparam RESERVE - Reserve hint for containers with reserve(), see `Reserve`.
+         */
+        template<class ITEM_CONVERTER, class CONTAINER, size_t RESERVE = Reserve::None>
+        class PackedArrayConverter : public CallbackConverter<PackedArrayConverter<ITEM_CONVERTER, CONTAINER, RESERVE>,CONTAINER>
+        {
+            static_assert(std::is_same<typename ITEM_CONVERTER::LocalType, typename CONTAINER::value_type>::value,
+                          "ITEM_CONVERTER::LocalType and CONTAINER::value_type should be same type");
+            static_assert(ITEM_CONVERTER::getWireType() != PB_WT_STRING,
+                          "Only scalar items can be packed");
+        public:
+            static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const CONTAINER &container){
+                if (container.empty())
+                    return true;
+
+                if (!FieldTag(field->tag, PB_WT_STRING).write(stream))
+                    return false;
+
+                size_t size;
+                switch (ITEM_CONVERTER::getWireType()) {
+                    case PB_WT_32BIT:
+                        size = container.size() * 4;
+                        break;
+                    case PB_WT_64BIT:
+                        size = container.size() * 8;
+                        break;
+                    default:
+                        if (!_getVarintItemsSize(container, size, 0))
+                            return false;
+                }
+
+                if (!pb_encode_varint(stream, size))
+                    return false;
+                return _encodeItems(stream, container, 0);
+            }
+            static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container){
+                return ArrayConverter<ITEM_CONVERTER, CONTAINER, RESERVE>::decodeCallback(stream, field, container);
+            }
+            static bool decodeReuseCallback(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container, size_t &count){
+                return ArrayConverter<ITEM_CONVERTER, CONTAINER, RESERVE>::decodeReuseCallback(stream, field, container, count);
+            }
+            static void decodeReuseFinish(CONTAINER &container, size_t count){
+                ArrayConverter<ITEM_CONVERTER, CONTAINER, RESERVE>::decodeReuseFinish(container, count);
+            }
+        private:
+            /**
+             * Varint items are converted to raw values in blocks, see `encodeVarints()`
+             */
+            template<class T = ITEM_CONVERTER>
+            static auto _getVarintItemsSize(const CONTAINER &container, size_t &size, int)
+                    -> decltype(T::ScalarType::toVarint(typename T::LocalType()), bool()) {
+                size = 0;
+                return _forEachVarintBlock<T>(container, [&size](const pb_uint64_t *values, size_t count){
+                    size += encodedVarintsSize(values, count);
+                    return true;
+                });
+            }
+
+            static bool _getVarintItemsSize(const CONTAINER &container, size_t &size, long){
+                pb_ostream_t sizingStream = PB_OSTREAM_SIZING;
+                if (!_encodeItems(&sizingStream, container, 0L))
+                    return false;
+                size = sizingStream.bytes_written;
+                return true;
+            }
+
+            template<class T = ITEM_CONVERTER>
+            static auto _encodeItems(pb_ostream_t *stream, const CONTAINER &container, int)
+                    -> decltype(T::ScalarType::toVarint(typename T::LocalType()), bool()) {
+                return _forEachVarintBlock<T>(container, [stream](const pb_uint64_t *values, size_t count){
+                    return encodeVarints(stream, values, count);
+                });
+            }
+
+            static bool _encodeItems(pb_ostream_t *stream, const CONTAINER &container, long){
+                if (FixedArrayBlock<ITEM_CONVERTER, CONTAINER>::isEnabled())
+                    return FixedArrayBlock<ITEM_CONVERTER, CONTAINER>::write(stream, container);
+
+                for (const auto &item: container) {
+                    if (!ITEM_CONVERTER::encodeValue(stream, item))
+                        return false;
+                }
+                return true;
+            }
+
+            template<class T, class FUNC>
+            static bool _forEachVarintBlock(const CONTAINER &container, FUNC func){
+                pb_uint64_t values[32];
+                auto it = container.begin();
+                while (it != container.end()) {
+                    size_t count = 0;
+                    for (; it != container.end() && count < sizeof(values) / sizeof(values[0]); ++it)
+                        values[count++] = T::ScalarType::toVarint(*it);
+                    if (!func(values, count))
+                        return false;
+                }
+                return true;
+            }
         };
 
         /**
@@ -567,8 +2675,9 @@ namespace NanoPb {
 
         public:
             static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const CONTAINER &container){
+                const FieldTag tag(field->tag, PB_WT_STRING);
                 for (auto &pair: container) {
-                    if (!pb_encode_tag_for_field(stream, field))
+                    if (!tag.write(stream))
                         return false;
 
                     ProtoPairType protoPair {
@@ -578,7 +2687,7 @@ namespace NanoPb {
 
                     VALUE_CONVERTER::template _mapEncoderApply<ProtoPairType>(protoPair);
 
-                    if (!pb_encode_submessage(stream, PROTO_PAIR_TYPE_MSG, &protoPair))
+                    if (!encodeSubMessage(*stream, PROTO_PAIR_TYPE_MSG, &protoPair, &pair))
                         return false;
                 }
                 return true;
@@ -604,8 +2713,134 @@ namespace NanoPb {
                 return true;
             }
 
+            /**
+             * Items with the same keys are overwritten, so duplicate key takes the last value (protobuf behavior),
+             * while decodeCallback() keeps the first one.
+             */
+            static bool decodeReuseCallback(pb_istream_t *stream, const pb_field_t *field, CONTAINER &container, size_t &count){
+                DecodeReuseContext* context = DecodeReuseContext::getActive();
+                count++;
+
+                if (!MemoryInputStream::getCurrentPosition(stream)) {
+                    // Can't read pair twice, decode it as usual
+                    LocalKeyType localKey;
+                    LocalValueType localValue;
+                    {
+                        DecodeReuseContext::MessageScope reuseScope(*context);
+                        ProtoPairType protoPair {
+                                .key = KEY_CONVERTER::decoderInit(localKey),
+                                .value = VALUE_CONVERTER::decoderInit(localValue)
+                        };
+                        if (!pb_decode(stream, PROTO_PAIR_TYPE_MSG, &protoPair))
+                            return false;
+                        reuseScope.finish();
+                        if (!KEY_CONVERTER::decoderApply(protoPair.key, localKey))
+                            return false;
+                        if (!VALUE_CONVERTER::decoderApply(protoPair.value, localValue))
+                            return false;
+                    }
+                    auto it = container.find(localKey);
+                    if (it != container.end())
+                        container.erase(it);
+                    it = container.insert(ContextPairType(std::move(localKey), std::move(localValue))).first;
+                    context->mark(&container, &it->second);
+                    return true;
+                }
+
+                // Each field of the pair is decoded once: key fields from the copy of the stream into the key buffer,
+                // then value fields into existing item. Entry fields are key = 1 and value = 2 in any map.
+                static const FieldMask keyMask({1});
+                static const FieldMask valueMask({2});
+
+                LocalKeyType& localKey = _getKeyBuffer();
+                {
+                    pb_istream_t keyStream = *stream;
+                    DecodeReuseContext::MessageScope reuseScope(*context);
+                    ProtoPairType protoPair = {};
+                    protoPair.key = KEY_CONVERTER::decoderInit(localKey);
+                    if (!keyMask._decode(keyStream, PROTO_PAIR_TYPE_MSG, &protoPair)) {
+#ifndef PB_NO_ERRMSG
+                        stream->errmsg = keyStream.errmsg;
+#endif
+                        return false;
+                    }
+                    reuseScope.finish();
+                    if (!KEY_CONVERTER::decoderApply(protoPair.key, localKey))
+                        return false;
+                }
+
+                auto it = container.find(localKey);
+                if (it == container.end())
+                    it = container.insert(ContextPairType(localKey, LocalValueType())).first;
+                context->mark(&container, &it->second);
+
+                DecodeReuseContext::MessageScope reuseScope(*context);
+                ProtoPairType protoPair = {};
+                protoPair.value = VALUE_CONVERTER::decoderInit(it->second);
+                if (!valueMask._decode(*stream, PROTO_PAIR_TYPE_MSG, &protoPair))
+                    return false;
+                reuseScope.finish();
+                return VALUE_CONVERTER::decoderApply(protoPair.value, it->second);
+            }
+
+            static void decodeReuseFinish(CONTAINER &container, size_t count){
+                const DecodeReuseContext* context = DecodeReuseContext::getActive();
+                if (container.size() == context->countMarks(&container))
+                    return;
+                for (auto it = container.begin(); it != container.end();) {
+                    if (context->isMarked(&container, &it->second))
+                        ++it;
+                    else
+                        it = container.erase(it);
+                }
+            }
+
+        private:
+            /**
+             * Key of the pair decoded by decodeReuseCallback(), keeps its memory between pairs.
+             */
+            static LocalKeyType& _getKeyBuffer(){
+                static thread_local LocalKeyType key;
+                return key;
+            }
+        };
+
+        /**
+         * Lazy message converter: keeps encoded sub message in `LazyMessage`, it is decoded on the first access.
+         */
+        template<class MESSAGE_CONVERTER>
+        class LazyMessageConverter : public CallbackConverter<
+                LazyMessageConverter<MESSAGE_CONVERTER>,
+                LazyMessage<MESSAGE_CONVERTER>>
+        {
+        public:
+            using LocalType = LazyMessage<MESSAGE_CONVERTER>;
+        public:
+            static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local){
+                if (!FieldTag(field->tag, PB_WT_STRING).write(stream))
+                    return false;
+                return encodeValue(stream, local);
+            }
+
+            static bool encodeValue(pb_ostream_t *stream, const LocalType &local){
+                if (local.hasEncoded())
+                    return pb_encode_string(stream, (const pb_byte_t *) local.getEncoded().data(), local.getEncoded().size());
+                return encodeSubMessage<MESSAGE_CONVERTER>(*stream, local._getValue());
+            }
+
+            static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local){
+                return Type::Bytes::decode(stream, local._setEncoded());
+            }
+
+            static void decodeReuseFinish(LocalType &local, size_t count){
+                if (count == 0)
+                    local._setEncoded().clear();
+            }
         };
 
+        template<class MESSAGE_CONVERTER>
+        struct EncodeItemValue<LazyMessageConverter<MESSAGE_CONVERTER>> : std::true_type {};
+
     }
 }
 
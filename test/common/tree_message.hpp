@@ -0,0 +1,209 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include "tests_common.h"
+#include "tree_message.pb.h"
+
+using namespace NanoPb::Converter;
+
+/**
+ * String converter, which counts encode and decode callbacks
+ */
+class CountingStringConverter : public CallbackConverter<CountingStringConverter, std::string> {
+public:
+    static size_t& encodeCalls(){
+        static size_t calls = 0;
+        return calls;
+    }
+
+    static size_t& decodeCalls(){
+        static size_t calls = 0;
+        return calls;
+    }
+
+    static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local){
+        encodeCalls()++;
+        return StringConverter::encodeCallback(stream, field, local);
+    }
+
+    static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local){
+        decodeCalls()++;
+        return StringConverter::decodeCallback(stream, field, local);
+    }
+};
+
+struct Leaf {
+    uint32_t number = 0;
+    std::string text;
+
+    Leaf() = default;
+
+    // Remove copy constructor to ensure that all can work without copy constructor
+    Leaf(const Leaf&) = delete;
+    Leaf(Leaf&&) = default;
+    Leaf& operator=(Leaf&&) = default;
+
+    Leaf(uint32_t number, const std::string &text) : number(number), text(text) {}
+
+    bool operator==(const Leaf &rhs) const {
+        return number == rhs.number &&
+               text == rhs.text;
+    }
+};
+
+struct Branch {
+    std::string name;
+    std::vector<Leaf> leaves;
+    std::map<std::string, Leaf> named;
+    std::vector<uint32_t> numbers;
+    std::vector<std::string> tags;
+
+    bool operator==(const Branch &rhs) const {
+        return name == rhs.name &&
+               leaves == rhs.leaves &&
+               named == rhs.named &&
+               numbers == rhs.numbers &&
+               tags == rhs.tags;
+    }
+};
+
+struct Tree {
+    std::vector<Branch> branches;
+    Branch main;
+
+    bool operator==(const Tree &rhs) const {
+        return branches == rhs.branches &&
+               main == rhs.main;
+    }
+};
+
+/**
+ * Leaf text is encoded with `CountingStringConverter`, so each call of its encode callback is an encode of `Leaf`.
+ */
+class LeafConverter : public MessageConverter<
+        LeafConverter,
+        Leaf,
+        PROTO_Leaf,
+        &PROTO_Leaf_msg>
+{
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .number = local.number,
+                .text = CountingStringConverter::encoderCallbackInit(local.text)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .text = CountingStringConverter::decoderCallbackInit(local.text)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        local.number = proto.number;
+        return true;
+    }
+};
+
+class BranchConverter : public MessageConverter<
+        BranchConverter,
+        Branch,
+        PROTO_Branch,
+        &PROTO_Branch_msg>
+{
+private:
+    using LeavesConverter = ArrayConverter<LeafConverter, std::vector<Leaf>>;
+    using NamedConverter = MapConverter<
+            StringConverter,
+            LeafConverter,
+            std::map<std::string, Leaf>,
+            PROTO_Branch_NamedEntry,
+            &PROTO_Branch_NamedEntry_msg>;
+    using NumbersConverter = PackedArrayConverter<UInt32Converter, std::vector<uint32_t>>;
+    using TagsConverter = ArrayConverter<StringConverter, std::vector<std::string>>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .name = StringConverter::encoderCallbackInit(local.name),
+                .leaves = LeavesConverter::encoderCallbackInit(local.leaves),
+                .named = NamedConverter::encoderCallbackInit(local.named),
+                .numbers = NumbersConverter::encoderCallbackInit(local.numbers),
+                .tags = TagsConverter::encoderCallbackInit(local.tags)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .name = StringConverter::decoderCallbackInit(local.name),
+                .leaves = LeavesConverter::decoderCallbackInit(local.leaves),
+                .named = NamedConverter::decoderCallbackInit(local.named),
+                .numbers = NumbersConverter::decoderCallbackInit(local.numbers),
+                .tags = TagsConverter::decoderCallbackInit(local.tags)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+class TreeConverter : public MessageConverter<
+        TreeConverter,
+        Tree,
+        PROTO_Tree,
+        &PROTO_Tree_msg>
+{
+private:
+    using BranchesConverter = ArrayConverter<BranchConverter, std::vector<Branch>>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .branches = BranchesConverter::encoderCallbackInit(local.branches),
+                .has_main = true,
+                .main = BranchConverter::encoderInit(local.main)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .branches = BranchesConverter::decoderCallbackInit(local.branches),
+                .has_main = false,
+                .main = BranchConverter::decoderInit(local.main)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+/**
+ * Branch with `size` items in each container. Odd seeds skip some fields.
+ */
+inline Branch createBranch(uint32_t seed, uint32_t size){
+    Branch ret;
+    if (seed % 2 == 0)
+        ret.name = "branch_with_long_name_" + std::to_string(seed);
+    for (uint32_t i = 0; i < size; i++){
+        const uint32_t value = seed * size + i;
+        ret.leaves.push_back(Leaf(value, "leaf_with_long_text_" + std::to_string(value)));
+        ret.named.emplace("name_" + std::to_string(i + seed), Leaf(value, std::string(value % 40, 'x')));
+        ret.numbers.push_back(value * 1000);
+        if (seed % 2 == 0)
+            ret.tags.push_back("tag_with_long_text_" + std::to_string(value));
+    }
+    return ret;
+}
+
+/**
+ * Tree with `size` branches, each with `size` items in each container. Odd seeds skip some fields.
+ */
+inline Tree createTree(uint32_t seed, uint32_t size){
+    Tree ret;
+    for (uint32_t b = 0; b < size; b++)
+        ret.branches.push_back(createBranch(seed + b * 2, size));
+    ret.main = createBranch(seed + size * 2, size);
+    return ret;
+}
@@ -1,4 +1,5 @@
 #include <float.h>
+#include <string.h>
 
 #include <vector>
 #include <list>
@@ -80,6 +81,41 @@ bool testRepeated(CONTAINER&& values){
     return original == decoded;
 }
 
+static size_t innerMessageEncodes = 0;
+
+/**
+ * Item converter with own encodeCallback(): it is called for each item, though converter inherits encodeValue()
+ */
+class CountingInnerMessageConverter : public InnerMessageConverter {
+public:
+    static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local){
+        innerMessageEncodes++;
+        return InnerMessageConverter::encodeCallback(stream, field, local);
+    }
+};
+
+bool testFieldTag(){
+    static constexpr NanoPb::FieldTag constTag(1, PB_WT_VARINT);
+    static_assert(constTag.size() == 1, "Tag 1 should be encoded with 1 byte");
+
+    const uint32_t tags[] = {1, 15, 16, 2047, 2048, 262143, 262144, 536870911};
+    const pb_wire_type_t wireTypes[] = {PB_WT_VARINT, PB_WT_64BIT, PB_WT_STRING, PB_WT_32BIT};
+
+    for (auto tag: tags) {
+        for (auto wireType: wireTypes) {
+            pb_byte_t expected[5];
+            pb_ostream_t stream = pb_ostream_from_buffer(expected, sizeof(expected));
+            if (!pb_encode_tag(&stream, wireType, tag))
+                return false;
+
+            const NanoPb::FieldTag fieldTag(tag, wireType);
+            if (fieldTag.size() != stream.bytes_written || memcmp(fieldTag.data(), expected, fieldTag.size()) != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
 #define TEST_ARRAY(PROTO_TYPE, TYPE, VALUES)  \
     {                                               \
     bool CONCAT(result,PROTO_TYPE) = testRepeated<                     \
@@ -96,6 +132,8 @@ bool testRepeated(CONTAINER&& values){
 int main() {
     int status = 0;
 
+    TEST(testFieldTag());
+
     // 32 bit types
 
     TEST_ARRAY(Int32,   std::vector<int32_t>,   {INT32_MIN _ 0 _ INT32_MAX});
@@ -158,6 +196,10 @@ int main() {
     TEST_ARRAY(InnerMessage,  std::vector<InnerMessage>, InnerMessage::createTestMessages<std::vector<InnerMessage>>());
     TEST_ARRAY(InnerMessage,  std::list<InnerMessage>, InnerMessage::createTestMessages<std::list<InnerMessage>>());
 
+    TEST((testRepeated<CountingInnerMessageConverter, std::vector<InnerMessage>, PROTO_Repeated_InnerMessage, &PROTO_Repeated_InnerMessage_msg>(
+            InnerMessage::createTestMessages<std::vector<InnerMessage>>())));
+    TEST(innerMessageEncodes == 3);
+
 
     return status;
 }
@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include <vector>
+
+#include "tests_common.h"
+#include "inner_message.hpp"
+#include "array.pb.h"
+
+using namespace NanoPb::Converter;
+
+static size_t allocations = 0;
+
+/**
+ * Allocator, which counts allocations
+ */
+template <class T>
+struct CountingAllocator : public std::allocator<T> {
+    template <class U>
+    struct rebind {
+        using other = CountingAllocator<U>;
+    };
+
+    CountingAllocator() = default;
+    template <class U>
+    CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        allocations++;
+        return std::allocator<T>::allocate(n);
+    }
+};
+
+template <class CONTAINER>
+struct TestMessage {
+    using ContainerType = CONTAINER;
+
+    ContainerType values;
+
+    TestMessage() = default;
+    TestMessage(const TestMessage&) = delete;
+    TestMessage(TestMessage&&) = default;
+
+    bool operator==(const TestMessage &rhs) const {
+        return values == rhs.values;
+    }
+};
+
+template <class ARRAY_CONVERTER, class CONTAINER, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG>
+class TestMessageConverter : public MessageConverter<
+        TestMessageConverter<ARRAY_CONVERTER, CONTAINER, PROTO_TYPE, PROTO_TYPE_MSG>,
+        TestMessage<CONTAINER>,
+        PROTO_TYPE,
+        PROTO_TYPE_MSG>
+{
+public:
+    using ProtoType = typename TestMessageConverter<ARRAY_CONVERTER, CONTAINER, PROTO_TYPE, PROTO_TYPE_MSG>::ProtoType;
+    using LocalType = TestMessage<CONTAINER>;
+public:
+    static constexpr bool countsFieldTags(){ return true; }
+
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .values = ARRAY_CONVERTER::encoderCallbackInit(local.values)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .values = ARRAY_CONVERTER::decoderCallbackInit(local.values)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+/**
+ * Stream, which is not a memory stream, so message can't be pre-scanned.
+ */
+static bool callbackRead(pb_istream_t *stream, pb_byte_t *buf, size_t count){
+    const pb_byte_t* source = static_cast<const pb_byte_t*>(stream->state);
+    if (buf)
+        memcpy(buf, source, count);
+    stream->state = (void*)(source + count);
+    return true;
+}
+
+/**
+ * Decode with the hint and check that items were allocated at once.
+ */
+template <class ITEM_CONVERTER, size_t RESERVE, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG, class CONTAINER>
+bool testReserve(const TestMessage<CONTAINER>& original, bool fromMemory, size_t expectedAllocations){
+    using Converter = TestMessageConverter<ArrayConverter<ITEM_CONVERTER, CONTAINER, RESERVE>, CONTAINER, PROTO_TYPE, PROTO_TYPE_MSG>;
+
+    NanoPb::StringOutputStream outputStream;
+    if (!NanoPb::encode<Converter>(outputStream, original))
+        return false;
+    auto buffer = outputStream.release();
+
+    TestMessage<CONTAINER> decoded;
+    allocations = 0;
+    if (fromMemory) {
+        if (!NanoPb::decode<Converter>(buffer->data(), buffer->size(), decoded))
+            return false;
+    } else {
+        pb_istream_t stream = {&callbackRead, (void*)buffer->data(), buffer->size()};
+        if (!NanoPb::decode<Converter>(stream, decoded))
+            return false;
+    }
+
+    if (!(original == decoded))
+        return false;
+    return expectedAllocations == 0 || allocations == expectedAllocations;
+}
+
+int main() {
+    int status = 0;
+
+    const size_t count = 100;
+
+    using InnerMessages = std::vector<InnerMessage, CountingAllocator<InnerMessage>>;
+    using Strings = std::vector<std::string, CountingAllocator<std::string>>;
+    using Numbers = std::vector<uint32_t, CountingAllocator<uint32_t>>;
+
+    TestMessage<InnerMessages> innerMessages;
+    TestMessage<Strings> strings;
+    TestMessage<Numbers> numbers;
+    for (size_t i = 0; i < count; i++) {
+        innerMessages.values.push_back(InnerMessage(i, "entry_" + std::to_string(i)));
+        strings.values.push_back("entry_" + std::to_string(i));
+        numbers.values.push_back(i);
+    }
+
+    // Count tags in the message from memory
+
+    TEST((testReserve<InnerMessageConverter, Reserve::CountTags, PROTO_Repeated_InnerMessage, &PROTO_Repeated_InnerMessage_msg>(innerMessages, true, 1)));
+    TEST((testReserve<StringConverter, Reserve::CountTags, PROTO_Repeated_String, &PROTO_Repeated_String_msg>(strings, true, 1)));
+
+    // Message can't be pre-scanned, just decode
+
+    TEST((testReserve<InnerMessageConverter, Reserve::CountTags, PROTO_Repeated_InnerMessage, &PROTO_Repeated_InnerMessage_msg>(innerMessages, false, 0)));
+    TEST((testReserve<StringConverter, Reserve::CountTags, PROTO_Repeated_String, &PROTO_Repeated_String_msg>(strings, false, 0)));
+
+    // Fixed hint, like max_count from .options
+
+    TEST((testReserve<UInt32Converter, count, PROTO_Repeated_UInt32, &PROTO_Repeated_UInt32_msg>(numbers, true, 1)));
+    TEST((testReserve<InnerMessageConverter, count, PROTO_Repeated_InnerMessage, &PROTO_Repeated_InnerMessage_msg>(innerMessages, false, 1)));
+
+    return status;
+}
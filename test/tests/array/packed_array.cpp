@@ -0,0 +1,346 @@
+#include <float.h>
+#include <string.h>
+
+#include <vector>
+#include <list>
+
+#include "tests_common.h"
+#include "simple_enum.hpp"
+#include "array.pb.h"
+
+using namespace NanoPb::Converter;
+
+template <class CONTAINER>
+struct TestMessage {
+    using ContainerType = CONTAINER;
+
+    ContainerType values;
+
+    TestMessage() = default;
+    TestMessage(const TestMessage&) = delete;
+    TestMessage(TestMessage&&) = default;
+    TestMessage(ContainerType&& values) : values(std::move(values)) {}
+
+    bool operator==(const TestMessage &rhs) const {
+        return values == rhs.values;
+    }
+
+    bool operator!=(const TestMessage &rhs) const {
+        return !(rhs == *this);
+    }
+};
+
+template <class ARRAY_CONVERTER, class CONTAINER, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG>
+class TestMessageConverter : public MessageConverter<
+        TestMessageConverter<ARRAY_CONVERTER, CONTAINER, PROTO_TYPE, PROTO_TYPE_MSG>,
+        TestMessage<CONTAINER>,
+        PROTO_TYPE,
+        PROTO_TYPE_MSG>
+{
+public:
+    using ProtoType = typename TestMessageConverter<ARRAY_CONVERTER, CONTAINER, PROTO_TYPE, PROTO_TYPE_MSG>::ProtoType;
+    using LocalType = TestMessage<CONTAINER>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .values = ARRAY_CONVERTER::encoderCallbackInit(local.values)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .values = ARRAY_CONVERTER::decoderCallbackInit(local.values)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+template <class CONVERTER, class CONTAINER>
+NanoPb::BufferPtr encodeMessage(const TestMessage<CONTAINER>& message){
+    NanoPb::StringOutputStream outputStream;
+    if (!NanoPb::encode<CONVERTER>(outputStream, message))
+        return nullptr;
+    return outputStream.release();
+}
+
+template <class CONVERTER, class CONTAINER>
+bool decodeMessage(const NanoPb::BufferPtr& buffer, const TestMessage<CONTAINER>& expected){
+    TestMessage<CONTAINER> decoded;
+    if (!NanoPb::decode<CONVERTER>(buffer->data(), buffer->size(), decoded))
+        return false;
+    return expected == decoded;
+}
+
+template <class ITEM_CONVERTER, class CONTAINER, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG>
+bool testPacked(CONTAINER&& values){
+    using PackedConverter = TestMessageConverter<PackedArrayConverter<ITEM_CONVERTER, CONTAINER>, CONTAINER, PROTO_TYPE, PROTO_TYPE_MSG>;
+    using UnpackedConverter = TestMessageConverter<ArrayConverter<ITEM_CONVERTER, CONTAINER>, CONTAINER, PROTO_TYPE, PROTO_TYPE_MSG>;
+
+    const TestMessage<CONTAINER> original(std::move(values));
+
+    auto packed = encodeMessage<PackedConverter>(original);
+    auto unpacked = encodeMessage<UnpackedConverter>(original);
+
+    if (!packed || !unpacked)
+        return false;
+
+    // Packed form is smaller for 3 and more items
+    if (packed->size() >= unpacked->size())
+        return false;
+
+    // Both converters should accept both forms
+    return decodeMessage<PackedConverter>(packed, original) &&
+           decodeMessage<PackedConverter>(unpacked, original) &&
+           decodeMessage<UnpackedConverter>(packed, original);
+}
+
+bool testEmptyPacked(){
+    // Packed field with zero length: tag 1, PB_WT_STRING, length 0
+    const pb_byte_t buffer[] = {0x0A, 0x00};
+
+    using Converter = TestMessageConverter<ArrayConverter<Int32Converter, std::vector<int32_t>>, std::vector<int32_t>,
+            PROTO_Repeated_Int32, &PROTO_Repeated_Int32_msg>;
+
+    TestMessage<std::vector<int32_t>> decoded;
+    if (!NanoPb::decode<Converter>(buffer, sizeof(buffer), decoded))
+        return false;
+    return decoded.values.empty();
+}
+
+/**
+ * Stream, which is not a memory stream, with unknown length: end of data is signaled to nanopb by zero bytes_left
+ */
+struct CallbackStreamState {
+    const pb_byte_t* data;
+    size_t size;
+};
+
+static bool callbackRead(pb_istream_t *stream, pb_byte_t *buf, size_t count){
+    auto state = static_cast<CallbackStreamState*>(stream->state);
+    if (count > state->size) {
+        stream->bytes_left = 0;
+        return false;
+    }
+    if (buf)
+        memcpy(buf, state->data, count);
+    state->data += count;
+    state->size -= count;
+    return true;
+}
+
+template <class CONVERTER, class CONTAINER>
+bool decodeFromCallback(const pb_byte_t* data, size_t size, TestMessage<CONTAINER>& decoded){
+    CallbackStreamState state = {data, size};
+    pb_istream_t stream = {&callbackRead, &state, SIZE_MAX};
+    return NanoPb::decode<CONVERTER>(stream, decoded);
+}
+
+/**
+ * Length of the packed field from non-memory stream is not trusted for allocation
+ */
+template <class ITEM_CONVERTER, class TYPE, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG>
+bool testForgedLength(){
+    using Converter = TestMessageConverter<PackedArrayConverter<ITEM_CONVERTER, std::vector<TYPE>>, std::vector<TYPE>, PROTO_TYPE, PROTO_TYPE_MSG>;
+
+    // Tag 1, PB_WT_STRING, length 0xFFFFFFF8 and just one item
+    const pb_byte_t forged[] = {0x0A, 0xF8, 0xFF, 0xFF, 0xFF, 0x0F, 1, 0, 0, 0, 0, 0, 0, 0};
+    TestMessage<std::vector<TYPE>> decoded;
+    if (decodeFromCallback<Converter>(forged, sizeof(forged), decoded))
+        return false;
+    return decoded.values.capacity() < 1024;
+}
+
+/**
+ * Values around every varint length boundary
+ */
+template <class TYPE>
+std::vector<TYPE> varintBoundaries(){
+    std::vector<TYPE> values;
+    for (int shift = 0; shift < 64; shift++) {
+        const uint64_t value = uint64_t(1) << shift;
+        values.push_back(TYPE(value));
+        values.push_back(TYPE(value - 1));
+        values.push_back(TYPE(0 - value));
+    }
+    return values;
+}
+
+template <class ITEM_CONVERTER, class TYPE, class PROTO_TYPE, const pb_msgdesc_t* PROTO_TYPE_MSG>
+bool testFixedBlock(){
+    using VectorConverter = TestMessageConverter<PackedArrayConverter<ITEM_CONVERTER, std::vector<TYPE>>, std::vector<TYPE>, PROTO_TYPE, PROTO_TYPE_MSG>;
+    using ListConverter = TestMessageConverter<PackedArrayConverter<ITEM_CONVERTER, std::list<TYPE>>, std::list<TYPE>, PROTO_TYPE, PROTO_TYPE_MSG>;
+
+    TestMessage<std::vector<TYPE>> vectorMessage;
+    TestMessage<std::list<TYPE>> listMessage;
+    for (int i = 0; i < 10000; i++) {
+        vectorMessage.values.push_back(TYPE(i) / 4);
+        listMessage.values.push_back(TYPE(i) / 4);
+    }
+
+    // Raw block (std::vector) and per-item (std::list) paths should produce same bytes
+    auto vectorBuffer = encodeMessage<VectorConverter>(vectorMessage);
+    auto listBuffer = encodeMessage<ListConverter>(listMessage);
+    if (!vectorBuffer || !listBuffer || *vectorBuffer != *listBuffer)
+        return false;
+
+    if (!decodeMessage<VectorConverter>(listBuffer, vectorMessage))
+        return false;
+
+    // Non-memory stream is read in chunks
+    TestMessage<std::vector<TYPE>> chunked;
+    if (!decodeFromCallback<VectorConverter>((const pb_byte_t*)vectorBuffer->data(), vectorBuffer->size(), chunked) || !(chunked == vectorMessage))
+        return false;
+
+    // Block size is not multiple of item size
+    const pb_byte_t invalid[] = {0x0A, sizeof(TYPE) + 1, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    TestMessage<std::vector<TYPE>> decoded;
+    return !NanoPb::decode<VectorConverter>(invalid, 2 + sizeof(TYPE) + 1, decoded);
+}
+
+/**
+ * Custom converter with fixed32 wire type: items are converted one by one, not as raw block.
+ */
+class OffsetFixed32Converter : public CallbackConverter<OffsetFixed32Converter, uint32_t> {
+public:
+    static constexpr pb_wire_type_t getWireType(){ return PB_WT_32BIT; }
+
+    static bool encodeCallback(pb_ostream_t *stream, const pb_field_t *field, const LocalType &local){
+        if (!pb_encode_tag_for_field(stream, field))
+            return false;
+        return encodeValue(stream, local);
+    }
+    static bool encodeValue(pb_ostream_t *stream, const LocalType &local){
+        const uint32_t value = local + 1;
+        return pb_encode_fixed32(stream, &value);
+    }
+    static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local){
+        uint32_t value;
+        if (!pb_decode_fixed32(stream, &value))
+            return false;
+        local = value - 1;
+        return true;
+    }
+};
+
+bool testCustomFixedConverter(){
+    using CustomConverter = TestMessageConverter<PackedArrayConverter<OffsetFixed32Converter, std::vector<uint32_t>>,
+            std::vector<uint32_t>, PROTO_Repeated_Fixed32, &PROTO_Repeated_Fixed32_msg>;
+    using PlainConverter = TestMessageConverter<PackedArrayConverter<Fixed32Converter, std::vector<uint32_t>>,
+            std::vector<uint32_t>, PROTO_Repeated_Fixed32, &PROTO_Repeated_Fixed32_msg>;
+
+    const TestMessage<std::vector<uint32_t>> original({1, 2, 3});
+    auto buffer = encodeMessage<CustomConverter>(original);
+    if (!buffer)
+        return false;
+
+    TestMessage<std::vector<uint32_t>> plain;
+    if (!NanoPb::decode<PlainConverter>(buffer->data(), buffer->size(), plain) || plain.values != std::vector<uint32_t>({2, 3, 4}))
+        return false;
+
+    TestMessage<std::vector<uint32_t>> decoded;
+    return NanoPb::decode<CustomConverter>(buffer->data(), buffer->size(), decoded) && decoded == original;
+}
+
+#define TEST_PACKED_ARRAY(PROTO_TYPE, TYPE, VALUES)  \
+    {                                               \
+    bool CONCAT(result,PROTO_TYPE) = testPacked<                     \
+        CONCAT(PROTO_TYPE,Converter),       \
+        TYPE,                                 \
+        CONCAT(PROTO_Repeated_,PROTO_TYPE),         \
+        &CONCAT3(PROTO_Repeated_,PROTO_TYPE,_msg)   \
+    >(VALUES);                                      \
+    TEST(CONCAT(result,PROTO_TYPE));                                   \
+    }
+
+#define _ , // Comma can't be passed to macro
+
+int main() {
+    int status = 0;
+
+    // 32 bit types
+
+    TEST_PACKED_ARRAY(Int32,   std::vector<int32_t>,   {INT32_MIN _ 0 _ INT32_MAX});
+    TEST_PACKED_ARRAY(Int32,   std::list<int32_t>,     {INT32_MIN _ 0 _ INT32_MAX});
+
+    TEST_PACKED_ARRAY(SInt32,  std::vector<int32_t>,   {INT32_MIN _ 0 _ INT32_MAX});
+    TEST_PACKED_ARRAY(SInt32,  std::list<int32_t>,     {INT32_MIN _ 0 _ INT32_MAX});
+
+    TEST_PACKED_ARRAY(UInt32,  std::vector<uint32_t>,  {0 _ 1 _ UINT32_MAX});
+    TEST_PACKED_ARRAY(UInt32,  std::list<uint32_t>,    {0 _ 1 _ UINT32_MAX});
+
+    TEST_PACKED_ARRAY(Fixed32, std::vector<uint32_t>,  {0 _ 1 _ UINT32_MAX});
+    TEST_PACKED_ARRAY(Fixed32, std::list<uint32_t>,    {0 _ 1 _ UINT32_MAX});
+
+    TEST_PACKED_ARRAY(SFixed32,std::vector<int32_t>,   {INT32_MIN _ 0 _ INT32_MAX});
+    TEST_PACKED_ARRAY(SFixed32,std::list<int32_t>,     {INT32_MIN _ 0 _ INT32_MAX});
+
+    TEST_PACKED_ARRAY(Float,   std::vector<float>,     {FLT_MIN _ 0 _ FLT_MAX});
+    TEST_PACKED_ARRAY(Float,   std::list<float>,       {FLT_MIN _ 0 _ FLT_MAX});
+
+    // 64 bit types
+
+#ifndef PB_WITHOUT_64BIT
+    TEST_PACKED_ARRAY(Int64,   std::vector<int64_t>,   {INT64_MIN _ 0 _ INT64_MAX});
+    TEST_PACKED_ARRAY(Int64,   std::list<int64_t>,     {INT64_MIN _ 0 _ INT64_MAX});
+
+    TEST_PACKED_ARRAY(SInt64,  std::vector<int64_t>,   {INT64_MIN _ 0 _ INT64_MAX});
+    TEST_PACKED_ARRAY(SInt64,  std::list<int64_t>,     {INT64_MIN _ 0 _ INT64_MAX});
+
+    TEST_PACKED_ARRAY(UInt64,  std::vector<uint64_t>,  {0 _ 1 _ UINT64_MAX});
+    TEST_PACKED_ARRAY(UInt64,  std::list<uint64_t>,    {0 _ 1 _ UINT64_MAX});
+
+    TEST_PACKED_ARRAY(Fixed64, std::vector<uint64_t>,  {0 _ 1 _ UINT64_MAX});
+    TEST_PACKED_ARRAY(Fixed64, std::list<uint64_t>,    {0 _ 1 _ UINT64_MAX});
+
+    TEST_PACKED_ARRAY(SFixed64,std::vector<int64_t>,   {INT64_MIN _ 0 _ INT64_MAX});
+    TEST_PACKED_ARRAY(SFixed64,std::list<int64_t>,     {INT64_MIN _ 0 _ INT64_MAX});
+
+    TEST_PACKED_ARRAY(Double,  std::vector<double>,    {DBL_MIN _ 0 _ DBL_MAX});
+    TEST_PACKED_ARRAY(Double,  std::list<double>,      {DBL_MIN _ 0 _ DBL_MAX});
+#endif
+
+    // Enum
+
+    TEST_PACKED_ARRAY(SimpleEnum,  std::vector<SimpleEnum>, {SimpleEnum::Invalid _ SimpleEnum::ValueOne _ SimpleEnum::ValueTwo});
+    TEST_PACKED_ARRAY(SimpleEnum,  std::list<SimpleEnum>,   {SimpleEnum::Invalid _ SimpleEnum::ValueOne _ SimpleEnum::ValueTwo});
+
+    // Block decoding of varint items
+
+    TEST_PACKED_ARRAY(Int32,   std::vector<int32_t>,   varintBoundaries<int32_t>());
+    TEST_PACKED_ARRAY(SInt32,  std::vector<int32_t>,   varintBoundaries<int32_t>());
+    TEST_PACKED_ARRAY(UInt32,  std::vector<uint32_t>,  varintBoundaries<uint32_t>());
+#ifndef PB_WITHOUT_64BIT
+    TEST_PACKED_ARRAY(Int64,   std::vector<int64_t>,   varintBoundaries<int64_t>());
+    TEST_PACKED_ARRAY(SInt64,  std::vector<int64_t>,   varintBoundaries<int64_t>());
+    TEST_PACKED_ARRAY(UInt64,  std::vector<uint64_t>,  varintBoundaries<uint64_t>());
+#endif
+
+    // Raw block encoding/decoding for fixed-width items
+
+    TEST((testFixedBlock<Fixed32Converter, uint32_t, PROTO_Repeated_Fixed32, &PROTO_Repeated_Fixed32_msg>()));
+    TEST((testFixedBlock<SFixed32Converter, int32_t, PROTO_Repeated_SFixed32, &PROTO_Repeated_SFixed32_msg>()));
+    TEST((testFixedBlock<FloatConverter, float, PROTO_Repeated_Float, &PROTO_Repeated_Float_msg>()));
+#ifndef PB_WITHOUT_64BIT
+    TEST((testFixedBlock<Fixed64Converter, uint64_t, PROTO_Repeated_Fixed64, &PROTO_Repeated_Fixed64_msg>()));
+    TEST((testFixedBlock<SFixed64Converter, int64_t, PROTO_Repeated_SFixed64, &PROTO_Repeated_SFixed64_msg>()));
+    TEST((testFixedBlock<DoubleConverter, double, PROTO_Repeated_Double, &PROTO_Repeated_Double_msg>()));
+#endif
+    TEST(testCustomFixedConverter());
+
+    // Forged length from non-memory stream
+
+    TEST((testForgedLength<Fixed32Converter, uint32_t, PROTO_Repeated_Fixed32, &PROTO_Repeated_Fixed32_msg>()));
+    TEST((testForgedLength<OffsetFixed32Converter, uint32_t, PROTO_Repeated_Fixed32, &PROTO_Repeated_Fixed32_msg>()));
+#ifndef PB_WITHOUT_64BIT
+    TEST((testForgedLength<DoubleConverter, double, PROTO_Repeated_Double, &PROTO_Repeated_Double_msg>()));
+#endif
+
+    // Empty packed field
+
+    TEST(testEmptyPacked());
+
+    return status;
+}
@@ -0,0 +1,84 @@
+#include "tests_common.h"
+
+#include "bytes.pb.h"
+
+using namespace NanoPb::Converter;
+
+struct TestMessage {
+    NanoPb::SharedBytes data;
+};
+
+class TestMessageConverter : public MessageConverter<
+        TestMessageConverter,
+        TestMessage,
+        PROTO_TestMessage,
+        &PROTO_TestMessage_msg>
+{
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .data = SharedBytesConverter::encoderCallbackInit(local.data)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .data = SharedBytesConverter::decoderCallbackInit(local.data)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+int main() {
+    int status = 0;
+
+    TestMessage original;
+    original.data = NanoPb::SharedBytes(std::string(1000, '\xAB'));
+
+    NanoPb::StringOutputStream outputStream;
+
+    TEST(NanoPb::encode<TestMessageConverter>(outputStream, original));
+
+    const NanoPb::SharedBufferPtr buffer(outputStream.release());
+
+    COMMENT("Decode slice of the shared buffer");
+    TestMessage decoded;
+    {
+        NanoPb::SharedInputStream inputStream(buffer);
+        TEST(NanoPb::decode<TestMessageConverter>(inputStream, decoded));
+    }
+    TEST(decoded.data == original.data);
+    TEST(decoded.data.getBuffer() == buffer);
+    TEST(decoded.data.data() == buffer->data() + buffer->size() - original.data.size());
+
+    COMMENT("Encode slice");
+    NanoPb::StringOutputStream sliceOutputStream;
+    TEST(NanoPb::encode<TestMessageConverter>(sliceOutputStream, decoded));
+    TEST(*sliceOutputStream.release() == *buffer);
+
+    COMMENT("Decode from other stream copies the value");
+    TestMessage copied;
+    TEST(NanoPb::decode<TestMessageConverter>(buffer->data(), buffer->size(), copied));
+    TEST(copied.data == original.data);
+    TEST(copied.data.getBuffer() != buffer);
+
+    COMMENT("Buffer is shared only while shared stream is decoded");
+    {
+        NanoPb::SharedInputStream inputStream(buffer);
+        TestMessage plain;
+        TEST(NanoPb::decode<TestMessageConverter>(buffer->data(), buffer->size(), plain));
+        TEST(plain.data == original.data);
+        TEST(plain.data.getBuffer() != buffer);
+
+        TestMessage reused;
+        NanoPb::DecodeReuseContext context;
+        TEST(NanoPb::decodeReuse<TestMessageConverter>(inputStream, reused, context));
+        TEST(reused.data == original.data);
+        TEST(reused.data.getBuffer() == buffer);
+    }
+
+    return status;
+}
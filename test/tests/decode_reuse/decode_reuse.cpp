@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include <new>
+#include <cstdlib>
+
+#include "tree_message.hpp"
+#include "decode_reuse.pb.h"
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+std::unique_ptr<std::string> encodeTree(const Tree& tree){
+    NanoPb::StringOutputStream outputStream;
+    if (!NanoPb::encode<TreeConverter>(outputStream, tree))
+        return nullptr;
+    return outputStream.release();
+}
+
+struct Garden {
+    uint32_t id = 0;
+    Branch branch;
+};
+
+class GardenConverter : public MessageConverter<
+        GardenConverter,
+        Garden,
+        PROTO_Garden,
+        &PROTO_Garden_msg>
+{
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .id = local.id,
+                .branch = BranchConverter::encoderCallbackInit(local.branch)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .branch = BranchConverter::decoderCallbackInit(local.branch)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        local.id = proto.id;
+        return true;
+    }
+};
+
+/**
+ * Stream, which is not a memory stream, so map items can't be found before decoding.
+ */
+static bool callbackRead(pb_istream_t *stream, pb_byte_t *buf, size_t count){
+    const pb_byte_t* source = static_cast<const pb_byte_t*>(stream->state);
+    if (buf)
+        memcpy(buf, source, count);
+    stream->state = (void*)(source + count);
+    return true;
+}
+
+int main() {
+    int status = 0;
+
+    const Tree big = createTree(0, 5);
+    const Tree small = createTree(1, 3);
+    const Tree other = createTree(2, 4);
+
+    auto bigBuffer = encodeTree(big);
+    auto smallBuffer = encodeTree(small);
+    auto otherBuffer = encodeTree(other);
+    TEST(bigBuffer && smallBuffer && otherBuffer);
+
+    NanoPb::DecodeReuseContext context;
+    Tree decoded;
+
+    COMMENT("Decode into empty object");
+    TEST(NanoPb::decodeReuse<TreeConverter>(bigBuffer->data(), bigBuffer->size(), decoded, context));
+    TEST(decoded == big);
+
+    COMMENT("Decode smaller message: leftovers are removed");
+    TEST(NanoPb::decodeReuse<TreeConverter>(smallBuffer->data(), smallBuffer->size(), decoded, context));
+    TEST(decoded == small);
+
+    COMMENT("Decode message with other map keys");
+    TEST(NanoPb::decodeReuse<TreeConverter>(otherBuffer->data(), otherBuffer->size(), decoded, context));
+    TEST(decoded == other);
+
+    COMMENT("Decode from non-memory stream");
+    {
+        pb_istream_t stream = {&callbackRead, (void*)smallBuffer->data(), smallBuffer->size()};
+        TEST(NanoPb::decodeReuse<TreeConverter>(stream, decoded, context));
+        TEST(decoded == small);
+    }
+
+    COMMENT("Decode same message again without allocations");
+    TEST(NanoPb::decodeReuse<TreeConverter>(bigBuffer->data(), bigBuffer->size(), decoded, context));
+    TEST(decoded == big);
+    allocations = 0;
+    bool result = NanoPb::decodeReuse<TreeConverter>(bigBuffer->data(), bigBuffer->size(), decoded, context);
+    const size_t reuseAllocations = allocations;
+    TEST(result);
+    TEST(decoded == big);
+    TEST(reuseAllocations == 0);
+
+    COMMENT("Decode map keys longer than SSO buffer again without allocations");
+    {
+        Branch branch = createBranch(0, 3);
+        branch.named.clear();
+        for (uint32_t i = 0; i < 3; i++)
+            branch.named.emplace("map_key_longer_than_sso_buffer_" + std::to_string(i), Leaf(i, "text"));
+        NanoPb::StringOutputStream branchStream;
+        TEST(NanoPb::encode<BranchConverter>(branchStream, branch));
+        auto branchBuffer = branchStream.release();
+
+        Branch decodedBranch;
+        TEST(NanoPb::decodeReuse<BranchConverter>(branchBuffer->data(), branchBuffer->size(), decodedBranch, context));
+        TEST(decodedBranch == branch);
+        allocations = 0;
+        result = NanoPb::decodeReuse<BranchConverter>(branchBuffer->data(), branchBuffer->size(), decodedBranch, context);
+        const size_t keyAllocations = allocations;
+        TEST(result);
+        TEST(decodedBranch == branch);
+        TEST(keyAllocations == 0);
+    }
+
+    COMMENT("Decode message without callback sub message: previous value is reset");
+    {
+        Garden garden;
+        garden.id = 1;
+        garden.branch = createBranch(0, 3);
+        NanoPb::StringOutputStream gardenStream;
+        TEST(NanoPb::encode<GardenConverter>(gardenStream, garden));
+        auto gardenBuffer = gardenStream.release();
+
+        PROTO_Garden proto = {};
+        proto.id = 2;
+        NanoPb::StringOutputStream emptyStream;
+        TEST(pb_encode(&emptyStream, &PROTO_Garden_msg, &proto));
+        auto emptyBuffer = emptyStream.release();
+
+        Garden decodedGarden;
+        TEST(NanoPb::decodeReuse<GardenConverter>(gardenBuffer->data(), gardenBuffer->size(), decodedGarden, context));
+        TEST(decodedGarden.id == 1);
+        TEST(decodedGarden.branch == garden.branch);
+        TEST(NanoPb::decodeReuse<GardenConverter>(emptyBuffer->data(), emptyBuffer->size(), decodedGarden, context));
+        TEST(decodedGarden.id == 2);
+        TEST(decodedGarden.branch == Branch());
+    }
+
+    COMMENT("Decode without reuse is not affected");
+    {
+        Tree fresh;
+        TEST(NanoPb::decode<TreeConverter>(smallBuffer->data(), smallBuffer->size(), fresh));
+        TEST(fresh == small);
+    }
+
+    return status;
+}
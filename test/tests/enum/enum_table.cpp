@@ -0,0 +1,134 @@
+#include <vector>
+
+#include "tests_common.h"
+#include "enum.pb.h"
+
+using namespace NanoPb::Converter;
+
+enum class SimpleEnum {
+    // Use other values than in proto, to be 100% sure
+    Invalid = 100,
+    ValueOne = 101,
+    ValueTwo = 102
+};
+
+class SimpleEnumConverter: public EnumTableConverter<SimpleEnumConverter, SimpleEnum, PROTO_SimpleEnum> {
+public:
+    static const NanoPb::EnumTable<LocalType, ProtoType>& getTable(){
+        static const NanoPb::EnumTable<LocalType, ProtoType> table({
+            {SimpleEnum::Invalid, PROTO_SimpleEnum_Invalid},
+            {SimpleEnum::ValueOne, PROTO_SimpleEnum_ValueOne},
+            {SimpleEnum::ValueTwo, PROTO_SimpleEnum_ValueTwo}
+        });
+        return table;
+    }
+};
+
+enum class SparseEnum {
+    Invalid = -1,
+    Small = 7,
+    Large = 1000000
+};
+
+class SparseEnumConverter: public EnumTableConverter<SparseEnumConverter, SparseEnum, PROTO_SimpleEnum> {
+public:
+    static const NanoPb::EnumTable<LocalType, ProtoType>& getTable(){
+        static const NanoPb::EnumTable<LocalType, ProtoType> table({
+            {SparseEnum::Invalid, PROTO_SimpleEnum_Invalid},
+            {SparseEnum::Small, PROTO_SimpleEnum_ValueOne},
+            {SparseEnum::Large, PROTO_SimpleEnum_ValueTwo}
+        });
+        return table;
+    }
+};
+
+struct EnumArray {
+    std::vector<SimpleEnum> values;
+    std::vector<SimpleEnum> unpacked;
+
+    bool operator==(const EnumArray &rhs) const {
+        return values == rhs.values &&
+               unpacked == rhs.unpacked;
+    }
+};
+
+class EnumArrayConverter : public MessageConverter<
+        EnumArrayConverter,
+        EnumArray,
+        PROTO_EnumArray,
+        &PROTO_EnumArray_msg>
+{
+private:
+    using ValuesConverter = PackedArrayConverter<SimpleEnumConverter, std::vector<SimpleEnum>>;
+    using UnpackedConverter = ArrayConverter<SimpleEnumConverter, std::vector<SimpleEnum>>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .values = ValuesConverter::encoderCallbackInit(local.values),
+                .unpacked = UnpackedConverter::encoderCallbackInit(local.unpacked)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .values = ValuesConverter::decoderCallbackInit(local.values),
+                .unpacked = UnpackedConverter::decoderCallbackInit(local.unpacked)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+template<class CONVERTER>
+int testEnumItem(typename CONVERTER::LocalType local, PROTO_SimpleEnum proto){
+    int status = 0;
+
+    TEST(CONVERTER::encode(local) == proto);
+    TEST(CONVERTER::decode(proto) == local);
+
+    return status;
+}
+
+int main() {
+    int status = 0;
+
+    COMMENT("Dense table");
+    status |= testEnumItem<SimpleEnumConverter>(SimpleEnum::Invalid, PROTO_SimpleEnum_Invalid);
+    status |= testEnumItem<SimpleEnumConverter>(SimpleEnum::ValueOne, PROTO_SimpleEnum_ValueOne);
+    status |= testEnumItem<SimpleEnumConverter>(SimpleEnum::ValueTwo, PROTO_SimpleEnum_ValueTwo);
+
+    COMMENT("Sparse table");
+    status |= testEnumItem<SparseEnumConverter>(SparseEnum::Invalid, PROTO_SimpleEnum_Invalid);
+    status |= testEnumItem<SparseEnumConverter>(SparseEnum::Small, PROTO_SimpleEnum_ValueOne);
+    status |= testEnumItem<SparseEnumConverter>(SparseEnum::Large, PROTO_SimpleEnum_ValueTwo);
+
+    COMMENT("Unknown values are mapped to the first pair");
+    TEST(SimpleEnumConverter::encode(static_cast<SimpleEnum>(5)) == PROTO_SimpleEnum_Invalid);
+    TEST(SimpleEnumConverter::decode(static_cast<PROTO_SimpleEnum>(3)) == SimpleEnum::Invalid);
+    TEST(SimpleEnumConverter::decodeValue(-3) == SimpleEnum::Invalid);
+    TEST(SimpleEnumConverter::decodeValue(50) == SimpleEnum::Invalid);
+    TEST(SparseEnumConverter::encode(static_cast<SparseEnum>(8)) == PROTO_SimpleEnum_Invalid);
+    TEST(SparseEnumConverter::decodeValue(77) == SparseEnum::Invalid);
+
+    COMMENT("Repeated enum");
+    {
+        EnumArray original;
+        for (int i = 0; i < 100; i++) {
+            original.values.push_back(static_cast<SimpleEnum>(100 + i % 3));
+            original.unpacked.push_back(static_cast<SimpleEnum>(102 - i % 3));
+        }
+
+        NanoPb::StringOutputStream outputStream;
+        TEST(NanoPb::encode<EnumArrayConverter>(outputStream, original));
+
+        auto inputStream = NanoPb::StringInputStream(outputStream.release());
+
+        EnumArray decoded;
+        TEST(NanoPb::decode<EnumArrayConverter>(inputStream, decoded));
+        TEST(decoded == original);
+    }
+
+    return status;
+}
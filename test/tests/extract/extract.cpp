@@ -0,0 +1,134 @@
+#include <vector>
+
+#include "tests_common.h"
+#include "extract.pb.h"
+
+using namespace NanoPb::Converter;
+
+struct Header {
+    std::string tenant;
+    uint32_t tenantId = 0;
+};
+
+struct Envelope {
+    Header header;
+    std::string body;
+    std::vector<std::string> tags;
+};
+
+class HeaderConverter : public MessageConverter<
+        HeaderConverter,
+        Header,
+        PROTO_Header,
+        &PROTO_Header_msg>
+{
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .tenant = StringConverter::encoderCallbackInit(local.tenant),
+                .tenant_id = local.tenantId
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .tenant = StringConverter::decoderCallbackInit(local.tenant)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        local.tenantId = proto.tenant_id;
+        return true;
+    }
+};
+
+class EnvelopeConverter : public MessageConverter<
+        EnvelopeConverter,
+        Envelope,
+        PROTO_Envelope,
+        &PROTO_Envelope_msg>
+{
+private:
+    using TagsConverter = ArrayConverter<StringConverter, std::vector<std::string>>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .has_header = true,
+                .header = HeaderConverter::encoderInit(local.header),
+                .body = BytesConverter::encoderCallbackInit(local.body),
+                .tags = TagsConverter::encoderCallbackInit(local.tags)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .has_header = false,
+                .header = HeaderConverter::decoderInit(local.header),
+                .body = BytesConverter::decoderCallbackInit(local.body),
+                .tags = TagsConverter::decoderCallbackInit(local.tags)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return HeaderConverter::decoderApply(proto.header, local.header);
+    }
+};
+
+int main() {
+    int status = 0;
+
+    Envelope original;
+    original.header.tenant = "tenant";
+    original.header.tenantId = 12345;
+    original.body = std::string(1000, 'b');
+    original.tags = {"first", "second", "last"};
+
+    NanoPb::StringOutputStream outputStream;
+    TEST(NanoPb::encode<EnvelopeConverter>(outputStream, original));
+    auto buffer = outputStream.release();
+
+    COMMENT("Extract nested fields");
+    uint32_t tenantId = 0;
+    TEST(NanoPb::extract<UInt32Converter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {1, 2}, tenantId));
+    TEST(tenantId == original.header.tenantId);
+
+    std::string tenant;
+    TEST(NanoPb::extract<StringConverter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {1, 1}, tenant));
+    TEST(tenant == original.header.tenant);
+
+    COMMENT("Extract top level fields");
+    std::string body;
+    TEST(NanoPb::extract<BytesConverter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {2}, body));
+    TEST(body == original.body);
+
+    std::string tag;
+    TEST(NanoPb::extract<StringConverter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {3}, tag));
+    TEST(tag == original.tags.back());
+
+    Header header;
+    TEST(NanoPb::extract<HeaderConverter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {1}, header));
+    TEST(header.tenant == original.header.tenant && header.tenantId == original.header.tenantId);
+
+    COMMENT("Extract from sub message split into several occurrences");
+    {
+        // Concatenated messages are merged: header of the second one has only tenant
+        Envelope second;
+        second.header.tenant = "other";
+        NanoPb::StringOutputStream secondStream;
+        TEST(NanoPb::encode<EnvelopeConverter>(secondStream, second));
+        const std::string merged = *buffer + *secondStream.release();
+
+        TEST(NanoPb::extract<UInt32Converter>(merged.data(), merged.size(), &PROTO_Envelope_msg, {1, 2}, tenantId));
+        TEST(tenantId == original.header.tenantId);
+        TEST(NanoPb::extract<StringConverter>(merged.data(), merged.size(), &PROTO_Envelope_msg, {1, 1}, tenant));
+        TEST(tenant == second.header.tenant);
+    }
+
+    COMMENT("Invalid paths");
+    TEST(!NanoPb::extract<UInt32Converter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {4}, tenantId));
+    TEST(!NanoPb::extract<UInt32Converter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {2, 1}, tenantId));
+    TEST(!NanoPb::extract<UInt32Converter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {1, 3}, tenantId));
+    TEST(!NanoPb::extract<UInt32Converter>(buffer->data(), buffer->size(), &PROTO_Envelope_msg, {}, tenantId));
+
+    return status;
+}
@@ -0,0 +1,114 @@
+#include <vector>
+
+#include "tests_common.h"
+#include "inner_message.hpp"
+#include "field_index.pb.h"
+
+struct Snapshot {
+    uint32_t version = 0;
+    std::vector<InnerMessage> items;
+    std::vector<std::string> names;
+    std::vector<uint32_t> numbers;
+};
+
+class SnapshotConverter : public MessageConverter<
+        SnapshotConverter,
+        Snapshot,
+        PROTO_Snapshot,
+        &PROTO_Snapshot_msg>
+{
+public:
+    using ItemsConverter = ArrayConverter<InnerMessageConverter, std::vector<InnerMessage>>;
+    using NamesConverter = ArrayConverter<StringConverter, std::vector<std::string>>;
+    using NumbersConverter = PackedArrayConverter<UInt32Converter, std::vector<uint32_t>>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .version = local.version,
+                .items = ItemsConverter::encoderCallbackInit(local.items),
+                .names = NamesConverter::encoderCallbackInit(local.names),
+                .numbers = NumbersConverter::encoderCallbackInit(local.numbers)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .items = ItemsConverter::decoderCallbackInit(local.items),
+                .names = NamesConverter::decoderCallbackInit(local.names),
+                .numbers = NumbersConverter::decoderCallbackInit(local.numbers)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        local.version = proto.version;
+        return true;
+    }
+};
+
+/**
+ * Broken converter, which doesn't read the value
+ */
+class NotReadingConverter : public CallbackConverter<NotReadingConverter, std::string> {
+public:
+    static bool decodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local){
+        return true;
+    }
+};
+
+int main() {
+    int status = 0;
+
+    const size_t count = 2000;
+
+    Snapshot original;
+    original.version = 3;
+    for (uint32_t i = 0; i < count; i++) {
+        original.items.push_back(InnerMessage(i, "item_" + std::to_string(i)));
+        original.names.push_back("name_" + std::to_string(i));
+        original.numbers.push_back(i * 1000);
+    }
+
+    NanoPb::StringOutputStream outputStream;
+    TEST(NanoPb::encode<SnapshotConverter>(outputStream, original));
+    auto buffer = outputStream.release();
+
+    NanoPb::FieldIndex index;
+    TEST(index.build(buffer->data(), buffer->size(), &PROTO_Snapshot_msg));
+
+    COMMENT("Count fields");
+    TEST(index.count(1) == 1);
+    TEST(index.count(2) == count);
+    TEST(index.count(3) == count);
+    TEST(index.count(4) == 1); // packed
+    TEST(index.count(5) == 0);
+
+    COMMENT("Decode single elements");
+    InnerMessage item;
+    TEST(index.decodeField<InnerMessageConverter>(2, 1234, item));
+    TEST(item == original.items[1234]);
+
+    std::string name;
+    TEST(index.decodeField<StringConverter>(3, count - 1, name));
+    TEST(name == original.names[count - 1]);
+
+    uint32_t version = 0;
+    TEST(index.decodeField<UInt32Converter>(1, 0, version));
+    TEST(version == original.version);
+
+    std::vector<uint32_t> numbers;
+    TEST(index.decodeField<SnapshotConverter::NumbersConverter>(4, 0, numbers));
+    TEST(numbers == original.numbers);
+
+    COMMENT("Missing elements");
+    TEST(!index.decodeField<InnerMessageConverter>(2, count, item));
+    TEST(index.find(5) == nullptr);
+
+    COMMENT("Converter doesn't read the value");
+    TEST(!index.decodeField<NotReadingConverter>(3, 0, name));
+
+    COMMENT("Malformed message");
+    NanoPb::FieldIndex truncated;
+    TEST(!truncated.build(buffer->data(), buffer->size() - 1, &PROTO_Snapshot_msg));
+
+    return status;
+}
@@ -0,0 +1,217 @@
+#include <string.h>
+
+#include <array>
+
+#include "tree_message.hpp"
+#include "field_mask.pb.h"
+
+struct Record {
+    uint32_t id = 0;
+    std::string name;
+    std::vector<std::string> tags;
+    Leaf main;
+    std::vector<Leaf> leaves;
+    std::array<uint32_t, 3> fixed = {};
+    pb_size_t choiceTag = 0; // Tag of the oneof member or 0
+    Leaf choice;
+    std::string comment;
+};
+
+class RecordConverter : public UnionMessageConverter<
+        RecordConverter,
+        Record,
+        PROTO_Record,
+        &PROTO_Record_msg>
+{
+private:
+    using TagsConverter = ArrayConverter<CountingStringConverter, std::vector<std::string>>;
+    using LeavesConverter = ArrayConverter<LeafConverter, std::vector<Leaf>>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        ProtoType ret{
+                .id = local.id,
+                .name = CountingStringConverter::encoderCallbackInit(local.name),
+                .tags = TagsConverter::encoderCallbackInit(local.tags),
+                .has_main = true,
+                .main = LeafConverter::encoderInit(local.main),
+                .leaves = LeavesConverter::encoderCallbackInit(local.leaves),
+                .comment = CountingStringConverter::encoderCallbackInit(local.comment)
+        };
+        std::copy(local.fixed.begin(), local.fixed.end(), ret.fixed);
+        ret.which_choice = local.choiceTag;
+        if (local.choiceTag == PROTO_Record_first_tag)
+            ret.choice.first = LeafConverter::encoderInit(local.choice);
+        else if (local.choiceTag == PROTO_Record_second_tag)
+            ret.choice.second = LeafConverter::encoderInit(local.choice);
+        return ret;
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .name = CountingStringConverter::decoderCallbackInit(local.name),
+                .tags = TagsConverter::decoderCallbackInit(local.tags),
+                .has_main = false,
+                .main = LeafConverter::decoderInit(local.main),
+                .leaves = LeavesConverter::decoderCallbackInit(local.leaves),
+                .cb_choice = unionDecoderInit(local),
+                .comment = CountingStringConverter::decoderCallbackInit(local.comment)
+        };
+    }
+
+    static bool unionDecodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local){
+        // Both members are Leaf messages
+        *static_cast<PROTO_Leaf *>(field->pData) = LeafConverter::decoderInit(local.choice);
+        return true;
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        local.id = proto.id;
+        std::copy(proto.fixed, proto.fixed + 3, local.fixed.begin());
+        local.choiceTag = proto.which_choice;
+        if (proto.which_choice == PROTO_Record_first_tag && !LeafConverter::decoderApply(proto.choice.first, local.choice))
+            return false;
+        if (proto.which_choice == PROTO_Record_second_tag && !LeafConverter::decoderApply(proto.choice.second, local.choice))
+            return false;
+        return LeafConverter::decoderApply(proto.main, local.main);
+    }
+};
+
+/**
+ * Stream, which is not a memory stream: end of data is signaled to nanopb by zero bytes_left
+ */
+struct CallbackStreamState {
+    const pb_byte_t* data;
+    size_t size;
+};
+
+static bool callbackRead(pb_istream_t *stream, pb_byte_t *buf, size_t count){
+    auto state = static_cast<CallbackStreamState*>(stream->state);
+    if (count > state->size) {
+        stream->bytes_left = 0;
+        return false;
+    }
+    if (buf)
+        memcpy(buf, state->data, count);
+    state->data += count;
+    state->size -= count;
+    return true;
+}
+
+int main() {
+    int status = 0;
+
+    Record original;
+    original.id = 42;
+    original.name = "record";
+    original.comment = "comment with tag > 64";
+    for (uint32_t i = 0; i < 10; i++) {
+        original.tags.push_back("tag_" + std::to_string(i));
+        original.leaves.push_back(Leaf(i, "leaf_" + std::to_string(i)));
+    }
+    original.main = Leaf(7, "main");
+    original.fixed = {{1, 2, 3}};
+    original.choiceTag = PROTO_Record_first_tag;
+    original.choice = Leaf(8, "first");
+
+    NanoPb::StringOutputStream outputStream;
+    TEST(NanoPb::encode<RecordConverter>(outputStream, original));
+    auto buffer = outputStream.release();
+
+    COMMENT("Decode callback fields from the mask");
+    {
+        const NanoPb::FieldMask mask({2, 100});
+        Record decoded;
+        CountingStringConverter::decodeCalls() = 0;
+        TEST(NanoPb::decode<RecordConverter>(buffer->data(), buffer->size(), decoded, mask));
+        TEST(CountingStringConverter::decodeCalls() == 2);
+        TEST(decoded.name == original.name);
+        TEST(decoded.comment == original.comment);
+        TEST(decoded.id == 0);
+        TEST(decoded.tags.empty());
+        TEST(decoded.leaves.empty());
+        TEST(decoded.main == Leaf());
+        TEST(decoded.fixed == (std::array<uint32_t, 3>{{0, 0, 0}}));
+        TEST(decoded.choiceTag == 0);
+    }
+
+    COMMENT("Decode static fields from the mask");
+    {
+        const NanoPb::FieldMask mask({1, 4});
+        Record decoded;
+        CountingStringConverter::decodeCalls() = 0;
+        TEST(NanoPb::decode<RecordConverter>(buffer->data(), buffer->size(), decoded, mask));
+        TEST(CountingStringConverter::decodeCalls() == 1);
+        TEST(decoded.id == original.id);
+        TEST(decoded.main == original.main);
+        TEST(decoded.name.empty());
+        TEST(decoded.tags.empty());
+    }
+
+    COMMENT("Decode fixed count array from the mask");
+    {
+        const NanoPb::FieldMask mask({6});
+        Record decoded;
+        TEST(NanoPb::decode<RecordConverter>(buffer->data(), buffer->size(), decoded, mask));
+        TEST(decoded.fixed == original.fixed);
+        TEST(decoded.id == 0);
+    }
+
+    COMMENT("Decode oneof member from the mask, other member is outside of the mask");
+    {
+        const NanoPb::FieldMask mask({7});
+        Record decoded;
+        CountingStringConverter::decodeCalls() = 0;
+        TEST(NanoPb::decode<RecordConverter>(buffer->data(), buffer->size(), decoded, mask));
+        TEST(CountingStringConverter::decodeCalls() == 1);
+        TEST(decoded.choiceTag == PROTO_Record_first_tag);
+        TEST(decoded.choice == original.choice);
+        TEST(decoded.name.empty());
+    }
+
+    COMMENT("Decoded oneof member outside of the mask is not applied");
+    {
+        const NanoPb::FieldMask mask({1, 8});
+        Record decoded;
+        TEST(NanoPb::decode<RecordConverter>(buffer->data(), buffer->size(), decoded, mask));
+        TEST(decoded.choiceTag == 0);
+        TEST(decoded.id == original.id);
+    }
+
+    COMMENT("Decode fields from the mask from non-memory stream");
+    {
+        const NanoPb::FieldMask mask({2, 5, 6, 7, 100});
+        Record decoded;
+        CallbackStreamState state = {(const pb_byte_t*)buffer->data(), buffer->size()};
+        pb_istream_t stream = {&callbackRead, &state, SIZE_MAX};
+        TEST(NanoPb::decode<RecordConverter>(stream, decoded, mask));
+        TEST(decoded.name == original.name);
+        TEST(decoded.leaves == original.leaves);
+        TEST(decoded.fixed == original.fixed);
+        TEST(decoded.choiceTag == PROTO_Record_first_tag);
+        TEST(decoded.choice == original.choice);
+        TEST(decoded.comment == original.comment);
+        TEST(decoded.id == 0);
+        TEST(decoded.tags.empty());
+        TEST(decoded.main == Leaf());
+    }
+
+    COMMENT("Truncated message");
+    {
+        const NanoPb::FieldMask mask({1});
+        Record decoded;
+        TEST(!NanoPb::decode<RecordConverter>(buffer->data(), buffer->size() - 1, decoded, mask));
+
+        CallbackStreamState state = {(const pb_byte_t*)buffer->data(), buffer->size() - 1};
+        pb_istream_t stream = {&callbackRead, &state, SIZE_MAX};
+        TEST(!NanoPb::decode<RecordConverter>(stream, decoded, mask));
+    }
+
+    COMMENT("Mask contains");
+    {
+        const NanoPb::FieldMask mask({1, 64, 65, 1000});
+        TEST(mask.contains(1) && mask.contains(64) && mask.contains(65) && mask.contains(1000));
+        TEST(!mask.contains(0) && !mask.contains(2) && !mask.contains(63) && !mask.contains(66) && !mask.contains(999));
+    }
+
+    return status;
+}
@@ -0,0 +1,78 @@
+#include "tests_common.h"
+#include "inner_message.hpp"
+#include "nanopb_cpp.h"
+#include "inner_callback.pb.h"
+
+using LazyInnerMessage = NanoPb::LazyMessage<InnerMessageConverter>;
+
+struct TestMessage {
+    LazyInnerMessage inner;
+};
+
+class TestMessageConverter : public MessageConverter<
+        TestMessageConverter,
+        TestMessage,
+        PROTO_TestMessage,
+        &PROTO_TestMessage_msg>
+{
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .inner = LazyMessageConverter<InnerMessageConverter>::encoderCallbackInit(local.inner)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .inner = LazyMessageConverter<InnerMessageConverter>::decoderCallbackInit(local.inner)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+int main() {
+    int status = 0;
+
+    // Inner message with fields in reverse order: text = "abc", number = 7
+    const std::string encoded("\x0A\x07" "\x12\x03" "abc" "\x08\x07", 9);
+
+    COMMENT("Decode without decoding inner message");
+    TestMessage decoded;
+    TEST(NanoPb::decode<TestMessageConverter>(encoded.data(), encoded.size(), decoded));
+    TEST(!decoded.inner.isDecoded());
+    TEST(decoded.inner.hasEncoded());
+
+    COMMENT("Read access keeps encoded bytes");
+    const InnerMessage* inner = decoded.inner.get();
+    TEST(inner != nullptr);
+    TEST(*inner == InnerMessage(7, "abc"));
+
+    NanoPb::StringOutputStream verbatimStream;
+    TEST(NanoPb::encode<TestMessageConverter>(verbatimStream, decoded));
+    TEST(*verbatimStream.release() == encoded);
+
+    COMMENT("Modified message is encoded from value");
+    decoded.inner.getMutable()->number = 8;
+    TEST(!decoded.inner.hasEncoded());
+
+    NanoPb::StringOutputStream modifiedStream;
+    TEST(NanoPb::encode<TestMessageConverter>(modifiedStream, decoded));
+    auto modified = modifiedStream.release();
+    TEST(*modified == std::string("\x0A\x07" "\x08\x08" "\x12\x03" "abc", 9));
+
+    COMMENT("Invalid inner message fails on access");
+    const std::string invalid("\x0A\x02" "\x12\x03", 4);
+    TestMessage invalidDecoded;
+    TEST(NanoPb::decode<TestMessageConverter>(invalid.data(), invalid.size(), invalidDecoded));
+    TEST(invalidDecoded.inner.get() == nullptr);
+
+    COMMENT("Default message");
+    TestMessage empty;
+    TEST(empty.inner.get() != nullptr);
+    TEST(*empty.inner.get() == InnerMessage());
+
+    return status;
+}
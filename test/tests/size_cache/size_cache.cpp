@@ -0,0 +1,75 @@
+#include "tree_message.hpp"
+
+int main() {
+    int status = 0;
+
+    const Tree original = createTree(0, 5);
+    size_t leaves = original.main.leaves.size();
+    size_t mapValues = original.main.named.size();
+    for (auto& branch : original.branches){
+        leaves += branch.leaves.size();
+        mapValues += branch.named.size();
+    }
+
+    CountingStringConverter::encodeCalls() = 0;
+    NanoPb::StringOutputStream outputStream;
+    TEST(NanoPb::encode<TreeConverter>(outputStream, original));
+    auto expected = outputStream.release();
+    // Without cache leaves are encoded once per each nesting level
+    TEST(CountingStringConverter::encodeCalls() > (leaves + mapValues) * 2);
+
+    NanoPb::EncodeSizeCache cache;
+
+    // Run twice to check that cache is reusable
+    for (int i = 0; i < 2; i++){
+        COMMENT("Encode with cache, iteration %d", i);
+
+        CountingStringConverter::encodeCalls() = 0;
+        NanoPb::StringOutputStream cachedOutputStream;
+        TEST(NanoPb::encode<TreeConverter>(cachedOutputStream, original, cache));
+        auto buffer = cachedOutputStream.release();
+
+        // Each sub message is encoded exactly twice: in sizing and in writing pass.
+        // Map value is a static sub message of the map entry, so nanopb sizes it once more in writing pass.
+        TEST(CountingStringConverter::encodeCalls() == leaves * 2 + mapValues * 3);
+        TEST(*buffer == *expected);
+
+        Tree decoded;
+        TEST(NanoPb::decode<TreeConverter>(buffer->data(), buffer->size(), decoded));
+        TEST(original == decoded);
+    }
+
+    COMMENT("Encode in single pass");
+    {
+        CountingStringConverter::encodeCalls() = 0;
+        NanoPb::StringOutputStream singlePassOutputStream;
+        TEST(NanoPb::encodeSinglePass<TreeConverter>(singlePassOutputStream, original));
+        // Each sub message is encoded once, but static sub messages are sized by nanopb:
+        // map value of the map entry and main branch, whose items are encoded once more in its sizing pass.
+        TEST(CountingStringConverter::encodeCalls() == leaves + mapValues * 2 + original.main.leaves.size() + original.main.named.size());
+        auto buffer = singlePassOutputStream.release();
+        // Length prefixes are padded
+        TEST(buffer->size() > expected->size());
+
+        Tree decoded;
+        TEST(NanoPb::decode<TreeConverter>(buffer->data(), buffer->size(), decoded));
+        TEST(original == decoded);
+
+        COMMENT("Single pass size and buffer stream");
+        pb_ostream_t sizingStream = PB_OSTREAM_SIZING;
+        TEST(NanoPb::encodeSinglePass<TreeConverter>(sizingStream, original));
+        TEST(sizingStream.bytes_written == buffer->size());
+
+        std::vector<pb_byte_t> data(sizingStream.bytes_written);
+        pb_ostream_t bufferStream = pb_ostream_from_buffer(data.data(), data.size());
+        TEST(NanoPb::encodeSinglePass<TreeConverter>(bufferStream, original));
+        TEST(bufferStream.bytes_written == data.size());
+        TEST(std::string((const char*)data.data(), data.size()) == *buffer);
+
+        COMMENT("Single pass into too small buffer");
+        pb_ostream_t shortStream = pb_ostream_from_buffer(data.data(), data.size() - 1);
+        TEST(!NanoPb::encodeSinglePass<TreeConverter>(shortStream, original));
+    }
+
+    return status;
+}
@@ -19,5 +19,18 @@ int main() {
     TEST(NanoPb::decode<TestMessageConverter>(inputStream, decoded));
 
     TEST(original == decoded);
+
+    size_t size = 0;
+
+    TEST(NanoPb::encodedSize<TestMessageConverter>(original, size));
+
+    NanoPb::StringOutputStream reservedOutputStream;
+
+    TEST(NanoPb::encode<TestMessageConverter>(reservedOutputStream, original, size));
+
+    auto buffer = reservedOutputStream.release();
+
+    TEST(buffer->size() == size);
+    TEST(buffer->capacity() >= size);
     return status;
 }
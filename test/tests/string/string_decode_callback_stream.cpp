@@ -0,0 +1,40 @@
+#include <string.h>
+
+#include "tests_common.h"
+#include "string_common.hpp"
+
+/**
+ * Stream, which is not a memory stream, so string is read in chunks.
+ */
+static bool callbackRead(pb_istream_t *stream, pb_byte_t *buf, size_t count){
+    const pb_byte_t* source = static_cast<const pb_byte_t*>(stream->state);
+    if (buf)
+        memcpy(buf, source, count);
+    stream->state = (void*)(source + count);
+    return true;
+}
+
+int main() {
+    int status = 0;
+
+    TestMessage original;
+    for (size_t i = 0; i < 1000; i++)
+        original.str += "chunk_" + std::to_string(i);
+
+    NanoPb::StringOutputStream outputStream;
+
+    TEST(NanoPb::encode<TestMessageConverter>(outputStream, original));
+
+    auto buffer = outputStream.release();
+
+    pb_istream_t inputStream = {&callbackRead, (void*)buffer->data(), buffer->size()};
+
+    TestMessage decoded;
+    decoded.str = "previous value";
+
+    TEST(NanoPb::decode<TestMessageConverter>(inputStream, decoded));
+
+    TEST(original == decoded);
+    TEST(inputStream.bytes_left == 0);
+    return status;
+}
@@ -0,0 +1,30 @@
+#include "tests_common.h"
+#include "string_common.hpp"
+
+int main() {
+    int status = 0;
+
+    const TestMessage original(
+            {"My super string"}
+    );
+
+    NanoPb::StringOutputStream outputStream;
+
+    TEST(NanoPb::encode<TestMessageConverter>(outputStream, original));
+
+    auto buffer = outputStream.release();
+
+    // Stream doesn't own the buffer
+    NanoPb::MemoryInputStream inputStream(buffer->data(), buffer->size());
+
+    TEST(NanoPb::MemoryInputStream::getCurrentPosition(&inputStream) == (const pb_byte_t*)buffer->data());
+
+    TestMessage decoded;
+
+    TEST(NanoPb::decode<TestMessageConverter>(inputStream, decoded));
+
+    TEST(original == decoded);
+    TEST(inputStream.bytes_left == 0);
+    TEST(NanoPb::MemoryInputStream::getCurrentPosition(&inputStream) == (const pb_byte_t*)buffer->data() + buffer->size());
+    return status;
+}
@@ -0,0 +1,79 @@
+#include <string.h>
+
+#include "tests_common.h"
+#include "string_common.hpp"
+
+struct TestViewMessage {
+    NanoPb::StringView str;
+};
+
+class TestViewMessageConverter : public MessageConverter<
+        TestViewMessageConverter,
+        TestViewMessage,
+        PROTO_TestMessage,
+        &PROTO_TestMessage_msg>
+{
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .str = StringViewConverter::encoderCallbackInit(local.str)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .str = StringViewConverter::decoderCallbackInit(local.str)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+static bool callbackRead(pb_istream_t *stream, pb_byte_t *buf, size_t count){
+    const pb_byte_t* source = static_cast<const pb_byte_t*>(stream->state);
+    if (buf)
+        memcpy(buf, source, count);
+    stream->state = (void*)(source + count);
+    return true;
+}
+
+int main() {
+    int status = 0;
+
+    const TestMessage original(
+            {"My super string"}
+    );
+
+    NanoPb::StringOutputStream outputStream;
+
+    TEST(NanoPb::encode<TestMessageConverter>(outputStream, original));
+
+    auto buffer = outputStream.release();
+
+    COMMENT("Decode view from memory");
+    TestViewMessage decoded;
+    TEST(NanoPb::decode<TestViewMessageConverter>(buffer->data(), buffer->size(), decoded));
+    TEST(decoded.str == NanoPb::StringView(original.str));
+    TEST(decoded.str.str() == original.str);
+    // View points into the buffer
+    TEST(decoded.str.data() == buffer->data() + buffer->size() - original.str.size());
+
+    COMMENT("Encode view");
+    NanoPb::StringOutputStream viewOutputStream;
+    TEST(NanoPb::encode<TestViewMessageConverter>(viewOutputStream, decoded));
+    TEST(*viewOutputStream.release() == *buffer);
+
+    COMMENT("Compare with empty view");
+    TEST(NanoPb::StringView() < decoded.str);
+    TEST(!(decoded.str < NanoPb::StringView()));
+    TEST(!(NanoPb::StringView() < NanoPb::StringView()));
+
+    COMMENT("Non-memory stream can't be decoded to view");
+    pb_istream_t inputStream = {&callbackRead, (void*)buffer->data(), buffer->size()};
+    TestViewMessage failed;
+    TEST(!NanoPb::decode<TestViewMessageConverter>(inputStream, failed));
+
+    return status;
+}
@@ -0,0 +1,223 @@
+#include <string.h>
+
+#include <vector>
+
+#include "tests_common.h"
+#include "strip_fields.pb.h"
+
+using namespace NanoPb::Converter;
+
+struct Address {
+    std::string street;
+    std::string city;
+
+    Address() = default;
+    Address(const Address&) = delete;
+    Address(Address&&) = default;
+    Address(const std::string &street, const std::string &city) : street(street), city(city) {}
+
+    bool operator==(const Address &rhs) const {
+        return street == rhs.street &&
+               city == rhs.city;
+    }
+};
+
+struct Person {
+    std::string name;
+    std::string email;
+    Address address;
+    std::vector<Address> history;
+    uint32_t id = 0;
+
+    bool operator==(const Person &rhs) const {
+        return name == rhs.name &&
+               email == rhs.email &&
+               address == rhs.address &&
+               history == rhs.history &&
+               id == rhs.id;
+    }
+};
+
+class AddressConverter : public MessageConverter<
+        AddressConverter,
+        Address,
+        PROTO_Address,
+        &PROTO_Address_msg>
+{
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .street = StringConverter::encoderCallbackInit(local.street),
+                .city = StringConverter::encoderCallbackInit(local.city)
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .street = StringConverter::decoderCallbackInit(local.street),
+                .city = StringConverter::decoderCallbackInit(local.city)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        return true;
+    }
+};
+
+class PersonConverter : public MessageConverter<
+        PersonConverter,
+        Person,
+        PROTO_Person,
+        &PROTO_Person_msg>
+{
+private:
+    using HistoryConverter = ArrayConverter<AddressConverter, std::vector<Address>>;
+public:
+    static ProtoType encoderInit(const LocalType& local) {
+        return ProtoType{
+                .name = StringConverter::encoderCallbackInit(local.name),
+                .email = StringConverter::encoderCallbackInit(local.email),
+                .has_address = true,
+                .address = AddressConverter::encoderInit(local.address),
+                .history = HistoryConverter::encoderCallbackInit(local.history),
+                .id = local.id
+        };
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+                .name = StringConverter::decoderCallbackInit(local.name),
+                .email = StringConverter::decoderCallbackInit(local.email),
+                .has_address = false,
+                .address = AddressConverter::decoderInit(local.address),
+                .history = HistoryConverter::decoderCallbackInit(local.history)
+        };
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        local.id = proto.id;
+        return AddressConverter::decoderApply(proto.address, local.address);
+    }
+};
+
+/**
+ * Stream, which is not a memory stream, so sub messages are buffered.
+ */
+static bool callbackRead(pb_istream_t *stream, pb_byte_t *buf, size_t count){
+    const pb_byte_t* source = static_cast<const pb_byte_t*>(stream->state);
+    if (buf)
+        memcpy(buf, source, count);
+    stream->state = (void*)(source + count);
+    return true;
+}
+
+/**
+ * Encode chain of nested nodes, innermost first.
+ */
+static std::string encodeNodes(size_t depth, bool withSecret){
+    std::string encoded;
+    for (size_t i = 0; i < depth; i++) {
+        const std::string name = "node_" + std::to_string(i);
+        const std::string secret = "secret_" + std::to_string(i);
+        NanoPb::StringOutputStream stream;
+        pb_encode_tag(&stream, PB_WT_STRING, PROTO_Node_name_tag);
+        pb_encode_string(&stream, (const pb_byte_t *) name.data(), name.size());
+        if (withSecret) {
+            pb_encode_tag(&stream, PB_WT_STRING, PROTO_Node_secret_tag);
+            pb_encode_string(&stream, (const pb_byte_t *) secret.data(), secret.size());
+        }
+        if (!encoded.empty()) {
+            pb_encode_tag(&stream, PB_WT_STRING, PROTO_Node_child_tag);
+            pb_encode_string(&stream, (const pb_byte_t *) encoded.data(), encoded.size());
+        }
+        encoded = *stream.release();
+    }
+    return encoded;
+}
+
+int main() {
+    int status = 0;
+
+    Person original;
+    original.name = "John Smith";
+    original.email = "john.smith@example.com";
+    original.address.street = "Long Street 12345";
+    original.address.city = "Springfield";
+    for (int i = 0; i < 100; i++)
+        original.history.push_back(Address("Old Street " + std::to_string(i), "City " + std::to_string(i)));
+    original.id = 12345;
+
+    Person expected;
+    expected.name = original.name;
+    expected.address.city = original.address.city;
+    for (const auto& item : original.history)
+        expected.history.push_back(Address("", item.city));
+    expected.id = original.id;
+
+    NanoPb::StringOutputStream outputStream;
+    TEST(NanoPb::encode<PersonConverter>(outputStream, original));
+    auto buffer = outputStream.release();
+
+    const NanoPb::FieldFilter filter({
+        {&PROTO_Person_msg, PROTO_Person_email_tag},
+        {&PROTO_Address_msg, PROTO_Address_street_tag}
+    });
+
+    COMMENT("Strip fields from memory stream");
+    {
+        NanoPb::MemoryInputStream inputStream(buffer->data(), buffer->size());
+        NanoPb::StringOutputStream strippedStream;
+        TEST(NanoPb::stripFields(inputStream, strippedStream, &PROTO_Person_msg, filter));
+        auto stripped = strippedStream.release();
+        TEST(stripped->size() < buffer->size());
+        TEST(stripped->find("Street") == std::string::npos);
+        TEST(stripped->find("example.com") == std::string::npos);
+
+        Person decoded;
+        TEST(NanoPb::decode<PersonConverter>(stripped->data(), stripped->size(), decoded));
+        TEST(decoded == expected);
+    }
+
+    COMMENT("Strip fields from non-memory stream");
+    {
+        pb_istream_t inputStream = {&callbackRead, (void*)buffer->data(), buffer->size()};
+        NanoPb::StringOutputStream strippedStream;
+        TEST(NanoPb::stripFields(inputStream, strippedStream, &PROTO_Person_msg, filter));
+        auto stripped = strippedStream.release();
+
+        Person decoded;
+        TEST(NanoPb::decode<PersonConverter>(stripped->data(), stripped->size(), decoded));
+        TEST(decoded == expected);
+    }
+
+    COMMENT("Message without filtered fields is copied as is");
+    {
+        const NanoPb::FieldFilter other({{&PROTO_Person_msg, 100}});
+        NanoPb::MemoryInputStream inputStream(buffer->data(), buffer->size());
+        NanoPb::StringOutputStream copyStream;
+        TEST(NanoPb::stripFields(inputStream, copyStream, &PROTO_Person_msg, other));
+        TEST(*copyStream.release() == *buffer);
+    }
+
+    COMMENT("Deeply nested message");
+    {
+        // Stripping each sub message twice per level would take 2^depth walks
+        const size_t depth = 24;
+        const std::string nodes = encodeNodes(depth, true);
+        const NanoPb::FieldFilter secrets({{&PROTO_Node_msg, PROTO_Node_secret_tag}});
+
+        NanoPb::MemoryInputStream inputStream(nodes.data(), nodes.size());
+        NanoPb::StringOutputStream strippedStream;
+        TEST(NanoPb::stripFields(inputStream, strippedStream, &PROTO_Node_msg, secrets));
+        TEST(*strippedStream.release() == encodeNodes(depth, false));
+    }
+
+    COMMENT("Truncated message");
+    {
+        NanoPb::MemoryInputStream inputStream(buffer->data(), buffer->size() - 5);
+        NanoPb::StringOutputStream strippedStream;
+        TEST(!NanoPb::stripFields(inputStream, strippedStream, &PROTO_Person_msg, filter));
+    }
+
+    return status;
+}
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include <vector>
 #include <memory>
 
@@ -101,6 +103,120 @@ int test_manual_decode(const UnionContainer& original) {
     return status;
 }
 
+// *** ENCODE/DECODE union message with prebuilt table ***
+template <class UNION_CONVERTER>
+int test_table(const UnionContainer& original) {
+    int status = 0;
+
+    static const NanoPb::UnionTable table(&PROTO_UnionContainer_msg);
+
+    TEST(table.findMessageType(PROTO_UnionContainer_msg1_tag) == UnionInnerOneConverter::getMsgType());
+    TEST(table.findMessageType(PROTO_UnionContainer_msg3_tag) == UnionInnerThreeConverter::getMsgType());
+    TEST(table.findMessageType(PROTO_UnionContainer_prefix_tag) == NULL);
+    TEST(table.findMessageType(1000) == NULL);
+    TEST(table.findTag(UnionInnerTwoConverter::getMsgType()) == PROTO_UnionContainer_msg2_tag);
+    TEST(table.findTag(&PROTO_UnionContainer_msg) == 0);
+
+    const NanoPb::UnionTable& shared = NanoPb::UnionTable::get(&PROTO_UnionContainer_msg);
+    TEST(&shared == &NanoPb::UnionTable::get(&PROTO_UnionContainer_msg));
+    TEST(shared.findTag(UnionInnerTwoConverter::getMsgType()) == PROTO_UnionContainer_msg2_tag);
+    const NanoPb::UnionTable& instantiated = NanoPb::UnionTable::get<&PROTO_UnionContainer_msg>();
+    TEST(&instantiated == &NanoPb::UnionTable::get<&PROTO_UnionContainer_msg>());
+    TEST(instantiated.findMessageType(PROTO_UnionContainer_msg3_tag) == UnionInnerThreeConverter::getMsgType());
+
+    NanoPb::StringOutputStream outputStream;
+
+    switch (original.message->getType()) {
+        case InnerMessage::Type::UnionInnerOne:
+            TEST(NanoPb::encodeUnionMessage<UnionInnerOneConverter>(outputStream, *original.message->as<UnionInnerOne>(), table));
+            break;
+        case InnerMessage::Type::UnionInnerTwo:
+            TEST(NanoPb::encodeUnionMessage<UnionInnerTwoConverter>(outputStream, *original.message->as<UnionInnerTwo>(), table));
+            break;
+        case InnerMessage::Type::UnionInnerThree:
+            TEST(NanoPb::encodeUnionMessage<UnionInnerThreeConverter>(outputStream, *original.message->as<UnionInnerThree>(), table));
+            break;
+    }
+
+    auto inputStream = NanoPb::StringInputStream(outputStream.release());
+
+    const pb_msgdesc_t* type = NanoPb::decodeUnionMessageType(inputStream, table);
+
+    switch (original.message->getType()) {
+        case InnerMessage::Type::UnionInnerOne:
+            TEST(type == UnionInnerOneConverter::getMsgType());
+            break;
+        case InnerMessage::Type::UnionInnerTwo:
+            TEST(type == UnionInnerTwoConverter::getMsgType());
+            break;
+        case InnerMessage::Type::UnionInnerThree:
+            TEST(type == UnionInnerThreeConverter::getMsgType());
+            break;
+    }
+
+    return status;
+}
+
+/**
+ * Stream, which is not a memory stream and can't be rewound.
+ */
+static bool callbackRead(pb_istream_t *stream, pb_byte_t *buf, size_t count){
+    const pb_byte_t* source = static_cast<const pb_byte_t*>(stream->state);
+    if (buf)
+        memcpy(buf, source, count);
+    stream->state = (void*)(source + count);
+    return true;
+}
+
+// *** DECODE union message in single pass ***
+template <class UNION_CONVERTER>
+int test_decode_union(const UnionContainer& original) {
+    int status = 0;
+
+    NanoPb::StringOutputStream outputStream;
+
+    TEST(NanoPb::encode<UNION_CONVERTER>(outputStream, original));
+
+    auto buffer = outputStream.release();
+    pb_istream_t inputStream = {&callbackRead, (void*)buffer->data(), buffer->size()};
+
+    UnionContainer decoded;
+    decoded.prefix = original.prefix;
+    decoded.suffix = original.suffix;
+    int calls = 0;
+
+    TEST(NanoPb::decodeUnion(inputStream, &PROTO_UnionContainer_msg,
+            NanoPb::unionCase<UnionInnerOneConverter>([&](UnionInnerOne& message){
+                decoded.message.reset(new UnionInnerOne(std::move(message)));
+                calls++;
+            }),
+            NanoPb::unionCase<UnionInnerTwoConverter>([&](UnionInnerTwo& message){
+                decoded.message.reset(new UnionInnerTwo(std::move(message)));
+                calls++;
+            }),
+            NanoPb::unionCase<UnionInnerThreeConverter>([&](UnionInnerThree& message){
+                decoded.message.reset(new UnionInnerThree(std::move(message)));
+                calls++;
+            })
+    ));
+
+    TEST(calls == 1);
+    TEST(original == decoded);
+
+    COMMENT("No matching case");
+    {
+        NanoPb::MemoryInputStream memoryStream(buffer->data(), buffer->size());
+        const bool hasCase = original.message->getType() == InnerMessage::Type::UnionInnerOne;
+        const bool result = NanoPb::decodeUnion<&PROTO_UnionContainer_msg>(memoryStream,
+                NanoPb::unionCase<UnionInnerOneConverter>([&](UnionInnerOne& message){ calls++; })
+        );
+        TEST(result == hasCase);
+        TEST(calls == (hasCase ? 2 : 1));
+    }
+
+    return status;
+}
+
 int main() {
     int status = 0;
 
@@ -114,6 +230,10 @@ int main() {
             status |= test_manual_encode<UnionContainerNoUnionConverter>(original);
             COMMENT("test_manual_decode, type: %d", (int)original.message->getType());
             status |= test_manual_decode<UnionContainerNoUnionConverter>(original);
+            COMMENT("test_table, type: %d", (int)original.message->getType());
+            status |= test_table<UnionContainerNoUnionConverter>(original);
+            COMMENT("test_decode_union, type: %d", (int)original.message->getType());
+            status |= test_decode_union<UnionContainerNoUnionConverter>(original);
         }
     }
 
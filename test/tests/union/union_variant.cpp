@@ -0,0 +1,185 @@
+#include <vector>
+#include <memory>
+
+#include "tests_common.h"
+#include "converter.hpp"
+
+using namespace NanoPb::Converter;
+
+template<class VARIANT>
+struct UnionVariantContainer {
+    int prefix = 0;
+    VARIANT message;
+    int suffix = 0;
+};
+
+template<class VARIANT>
+class UnionVariantContainerConverter : public UnionMessageConverter<
+        UnionVariantContainerConverter<VARIANT>,
+        UnionVariantContainer<VARIANT>,
+        PROTO_UnionContainer,
+        &PROTO_UnionContainer_msg>
+{
+private:
+    using VariantConverter = UnionVariantConverter<
+            VARIANT,
+            UnionVariantCase<PROTO_UnionContainer_msg1_tag, UnionInnerOneConverter>,
+            UnionVariantCase<PROTO_UnionContainer_msg2_tag, UnionInnerTwoConverter>,
+            UnionVariantCase<PROTO_UnionContainer_msg3_tag, UnionInnerThreeConverter>>;
+public:
+    using LocalType = UnionVariantContainer<VARIANT>;
+    using ProtoType = PROTO_UnionContainer;
+
+    static ProtoType encoderInit(const LocalType& local) {
+        ProtoType ret {
+            .prefix = local.prefix,
+            .suffix = local.suffix
+        };
+        ret.which_msg = VariantConverter::encoderInit(local.message, &ret.msg);
+        return ret;
+    }
+
+    static ProtoType decoderInit(LocalType& local){
+        return ProtoType{
+            .cb_msg = UnionVariantContainerConverter::unionDecoderInit(local)
+        };
+    }
+
+    static bool unionDecodeCallback(pb_istream_t *stream, const pb_field_t *field, LocalType &local){
+        return VariantConverter::unionDecodeCallback(stream, field, local.message);
+    }
+
+    static bool decoderApply(const ProtoType& proto, LocalType& local){
+        local.prefix = proto.prefix;
+        local.suffix = proto.suffix;
+        return VariantConverter::decoderApply(proto.which_msg, &proto.msg, local.message);
+    }
+};
+
+template<class VARIANT>
+void copyMessage(const UnionContainer& original, VARIANT& variant){
+    switch (original.message->getType()) {
+        case InnerMessage::Type::UnionInnerOne:
+            variant.template emplace<UnionInnerOne>(original.message->as<UnionInnerOne>()->number);
+            break;
+        case InnerMessage::Type::UnionInnerTwo:
+            variant.template emplace<UnionInnerTwo>(original.message->as<UnionInnerTwo>()->str);
+            break;
+        case InnerMessage::Type::UnionInnerThree:
+            variant.template emplace<UnionInnerThree>(original.message->as<UnionInnerThree>()->values);
+            break;
+    }
+}
+
+template<class VARIANT>
+bool isSameMessage(const UnionContainer& original, const VARIANT& variant){
+    using Traits = NanoPb::VariantTraits<VARIANT>;
+    switch (original.message->getType()) {
+        case InnerMessage::Type::UnionInnerOne:
+            return Traits::index(variant) == 0 && Traits::template get<UnionInnerOne>(variant) == *original.message->as<UnionInnerOne>();
+        case InnerMessage::Type::UnionInnerTwo:
+            return Traits::index(variant) == 1 && Traits::template get<UnionInnerTwo>(variant) == *original.message->as<UnionInnerTwo>();
+        case InnerMessage::Type::UnionInnerThree:
+            return Traits::index(variant) == 2 && Traits::template get<UnionInnerThree>(variant) == *original.message->as<UnionInnerThree>();
+    }
+    return false;
+}
+
+template <class VARIANT>
+int test_variant(const UnionContainer& original){
+    int status = 0;
+
+    using Converter = UnionVariantContainerConverter<VARIANT>;
+
+    UnionVariantContainer<VARIANT> local;
+    local.prefix = original.prefix;
+    local.suffix = original.suffix;
+    copyMessage(original, local.message);
+
+    NanoPb::StringOutputStream outputStream;
+    TEST(NanoPb::encode<Converter>(outputStream, local));
+    auto buffer = outputStream.release();
+
+    COMMENT("Same encoding as with heap allocated message");
+    {
+        NanoPb::StringOutputStream expectedStream;
+        TEST(NanoPb::encode<UnionContainerNoUnionConverter>(expectedStream, original));
+        TEST(*expectedStream.release() == *buffer);
+    }
+
+    COMMENT("Decode");
+    {
+        UnionVariantContainer<VARIANT> decoded;
+        TEST(NanoPb::decode<Converter>(buffer->data(), buffer->size(), decoded));
+        TEST(decoded.prefix == original.prefix);
+        TEST(decoded.suffix == original.suffix);
+        TEST(isSameMessage(original, decoded.message));
+    }
+
+    return status;
+}
+
+int main() {
+    int status = 0;
+
+    using Variant = NanoPb::InlineVariant<UnionInnerOne, UnionInnerTwo, UnionInnerThree>;
+
+    const auto messages = UnionContainer::createTestMessages();
+
+    for (auto& original : messages){
+        COMMENT("test_variant InlineVariant, type: %d", (int)original.message->getType());
+        status |= test_variant<Variant>(original);
+#if __cplusplus >= 201703L
+        COMMENT("test_variant std::variant, type: %d", (int)original.message->getType());
+        status |= test_variant<std::variant<UnionInnerOne, UnionInnerTwo, UnionInnerThree>>(original);
+        COMMENT("test_variant std::variant with std::monostate, type: %d", (int)original.message->getType());
+        status |= test_variant<std::variant<std::monostate, UnionInnerOne, UnionInnerTwo, UnionInnerThree>>(original);
+#endif
+    }
+
+    COMMENT("Empty variant");
+    {
+        UnionVariantContainer<Variant> local;
+        local.prefix = 5;
+        NanoPb::StringOutputStream outputStream;
+        TEST(NanoPb::encode<UnionVariantContainerConverter<Variant>>(outputStream, local));
+        auto buffer = outputStream.release();
+
+        UnionVariantContainer<Variant> decoded;
+        decoded.message.emplace<UnionInnerOne>(1);
+        TEST(NanoPb::decode<UnionVariantContainerConverter<Variant>>(buffer->data(), buffer->size(), decoded));
+        TEST(decoded.prefix == 5);
+        TEST(decoded.message.empty());
+    }
+
+#if __cplusplus >= 201703L
+    COMMENT("Empty std::variant with std::monostate");
+    {
+        using StdVariant = std::variant<std::monostate, UnionInnerOne, UnionInnerTwo, UnionInnerThree>;
+        UnionVariantContainer<StdVariant> local;
+        local.prefix = 5;
+        NanoPb::StringOutputStream outputStream;
+        TEST(NanoPb::encode<UnionVariantContainerConverter<StdVariant>>(outputStream, local));
+        auto buffer = outputStream.release();
+
+        UnionVariantContainer<StdVariant> decoded;
+        decoded.message.emplace<UnionInnerOne>(1);
+        TEST(NanoPb::decode<UnionVariantContainerConverter<StdVariant>>(buffer->data(), buffer->size(), decoded));
+        TEST(decoded.prefix == 5);
+        TEST(std::holds_alternative<std::monostate>(decoded.message));
+    }
+#endif
+
+    COMMENT("Move variant");
+    {
+        Variant variant;
+        variant.emplace<UnionInnerTwo>("Moved string");
+        Variant moved(std::move(variant));
+        TEST(variant.empty());
+        TEST(moved.is<UnionInnerTwo>());
+        TEST(moved.get<UnionInnerTwo>()->str == "Moved string");
+        TEST(moved.get<UnionInnerOne>() == nullptr);
+    }
+
+    return status;
+}